@@ -1,72 +1,767 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <getopt.h>
+#include <sched.h>
+#include <limits.h>
+#include <stdatomic.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 
-int main() {
+// bulk transfer methods, parent (writer) -> child (reader)
+#define METHOD_RW 0       // write() into the pipe, read() out of it
+#define METHOD_VMSPLICE 1 // vmsplice() the writer's pages into the pipe, read() out of it
+#define METHOD_SPLICE 2   // vmsplice() in, splice() out to /dev/null: no copy on either side
+const char *method_names[] = {"rw", "vmsplice", "splice"};
+
+#define DEFAULT_VOLUME (1024L * 1024 * 1024)
+#define PIPE_MAX_SIZE "/proc/sys/fs/pipe-max-size"
+
+// round-trip latency transports: the parent pings, the child pongs straight back
+#define TRANSPORT_PIPE 0
+#define TRANSPORT_SOCKET 1
+#define TRANSPORT_EVENTFD 2
+#define TRANSPORT_FUTEX 3
+const char *transport_names[] = {"pipe", "socketpair", "eventfd", "futex"};
+
+#define WARMUP_TRIPS 10000
+
+// pipelined rpc: the parent keeps up to a window of requests in flight, the child answers
+// each one in order; every window in the list gets its own run
+#define RPC_PAYLOAD 24
+#define RPC_BUFFER (64 * 1024)
+#define DEFAULT_WINDOWS "1,4,16,64,256,1024"
+#define MAX_WINDOWS 32
+
+// one direction of a round trip: a descriptor pair, or for the futex transport the value the
+// shared turn word takes when it is this direction's receiver's turn
+typedef struct {
+    int rd;
+    int wr;
+    uint32_t turn;
+} direction_t;
+
+typedef struct {
+    int transport;
+    direction_t ping; // parent -> child
+    direction_t pong; // child -> parent
+    _Atomic uint32_t *turn;
+} channel_t;
+
+// one rpc frame: the request id, the payload length, then the payload; a reply carries the id
+// of the request it answers and the payload back with every byte incremented
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+    unsigned char payload[RPC_PAYLOAD];
+} rpc_frame_t;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// parse a byte count with an optional K, M or G suffix
+static size_t parse_size(const char *s) {
+    char *end;
+    size_t n = strtoull(s, &end, 10);
+    switch (*end) {
+        case 'G': case 'g': n <<= 30; break;
+        case 'M': case 'm': n <<= 20; break;
+        case 'K': case 'k': n <<= 10; break;
+    }
+    return n;
+}
+
+// largest pipe an unprivileged process may ask for with F_SETPIPE_SZ
+static int pipe_max_size() {
+    int size = 1024 * 1024;
+    FILE *f = fopen(PIPE_MAX_SIZE, "r");
+    if (f != NULL) {
+        if (fscanf(f, "%d", &size) != 1) {
+            size = 1024 * 1024;
+        }
+        fclose(f);
+    }
+    return size;
+}
+
+// child side of a bulk run: drain volume bytes from fd, then report the count back on ack
+static void bulk_reader(int method, int fd, int ack, size_t volume, size_t chunk) {
+    char *buffer = NULL;
+    int devnull = -1;
+    if (method == METHOD_SPLICE) {
+        devnull = open("/dev/null", O_WRONLY);
+        if (devnull == -1) {
+            perror("open /dev/null failed");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        buffer = malloc(chunk);
+        if (buffer == NULL) {
+            perror("malloc failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    size_t total = 0;
+    while (total < volume) {
+        ssize_t n;
+        if (method == METHOD_SPLICE) {
+            n = splice(fd, NULL, devnull, NULL, chunk, SPLICE_F_MOVE);
+        } else {
+            n = read(fd, buffer, chunk);
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            break;
+        }
+        total += n;
+    }
+    write(ack, &total, sizeof(total));
+    free(buffer);
+    exit(EXIT_SUCCESS);
+}
+
+// parent side of a bulk run: push volume bytes into fd in chunk sized pieces. The pages are
+// never changed after they are filled, so vmsplice can hand the same ones over again and
+// again without the reader ever seeing them modified
+static void bulk_writer(int method, int fd, const char *buffer, size_t volume, size_t chunk) {
+    size_t total = 0;
+    while (total < volume) {
+        size_t len = (volume - total < chunk) ? volume - total : chunk;
+        ssize_t n;
+        if (method == METHOD_RW) {
+            n = write(fd, buffer, len);
+        } else {
+            struct iovec iov = { (void *)buffer, len };
+            n = vmsplice(fd, &iov, 1, 0);
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("pipe write failed");
+            exit(EXIT_FAILURE);
+        }
+        total += n;
+    }
+}
+
+// stream volume bytes from parent to child with one method and pipe size (0 keeps the
+// default) and print the throughput
+static void bulk_run(int method, int pipe_size, size_t volume, size_t chunk) {
+    int pipe_parent_to_child[2]; // the data
+    int pipe_child_to_parent[2]; // the child's byte count once it has read everything
+
+    if (pipe(pipe_parent_to_child) == -1 || pipe(pipe_child_to_parent) == -1) {
+        perror("pipe creation failed");
+        exit(EXIT_FAILURE);
+    }
+    if (pipe_size > 0 && fcntl(pipe_parent_to_child[1], F_SETPIPE_SZ, pipe_size) == -1) {
+        perror("F_SETPIPE_SZ failed");
+        exit(EXIT_FAILURE);
+    }
+    int actual_size = fcntl(pipe_parent_to_child[1], F_GETPIPE_SZ);
+    // a chunk of one pipe's worth lets each call fill or drain the pipe completely
+    size_t io_chunk = chunk ? chunk : (size_t)actual_size;
+
+    // don't let the child flush a copy of earlier results
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork failed");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        close(pipe_parent_to_child[1]);
+        close(pipe_child_to_parent[0]);
+        bulk_reader(method, pipe_parent_to_child[0], pipe_child_to_parent[1], volume, io_chunk);
+    }
+    close(pipe_parent_to_child[0]);
+    close(pipe_child_to_parent[1]);
+
+    // page aligned so vmsplice maps whole pages into the pipe
+    char *buffer = aligned_alloc(4096, (io_chunk + 4095) & ~(size_t)4095);
+    if (buffer == NULL) {
+        perror("aligned_alloc failed");
+        exit(EXIT_FAILURE);
+    }
+    memset(buffer, 'x', io_chunk);
+
+    uint64_t start = now_ns();
+    bulk_writer(method, pipe_parent_to_child[1], buffer, volume, io_chunk);
+    close(pipe_parent_to_child[1]);
+    size_t received = 0;
+    read(pipe_child_to_parent[0], &received, sizeof(received));
+    double secs = (now_ns() - start) / 1e9;
+
+    close(pipe_child_to_parent[0]);
+    waitpid(pid, NULL, 0);
+    free(buffer);
+
+    if (received != volume) {
+        fprintf(stderr, "%s: child received %zu of %zu bytes\n", method_names[method], received, volume);
+        exit(EXIT_FAILURE);
+    }
+    printf("%-9s pipe %5d KB  chunk %5zu KB  %6.2f GB/s\n", method_names[method],
+           actual_size / 1024, io_chunk / 1024, volume / secs / 1e9);
+}
+
+// process-shared futex call on the turn word
+static long futex(_Atomic uint32_t *addr, int op, uint32_t val) {
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+// pin the calling process to cpu; -1 leaves it to the scheduler
+static void pin_cpu(int cpu) {
+    if (cpu < 0) {
+        return;
+    }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        perror("sched_setaffinity failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// create the descriptors (or shared turn word) of one transport before forking
+static void channel_open(channel_t *c, int transport) {
+    memset(c, 0, sizeof(*c));
+    c->transport = transport;
+    if (transport == TRANSPORT_PIPE) {
+        int p[2], q[2];
+        if (pipe(p) == -1 || pipe(q) == -1) {
+            perror("pipe creation failed");
+            exit(EXIT_FAILURE);
+        }
+        c->ping = (direction_t){ p[0], p[1], 0 };
+        c->pong = (direction_t){ q[0], q[1], 0 };
+    } else if (transport == TRANSPORT_SOCKET) {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == -1) {
+            perror("socketpair failed");
+            exit(EXIT_FAILURE);
+        }
+        c->ping = (direction_t){ sv[1], sv[0], 0 };
+        c->pong = (direction_t){ sv[0], sv[1], 0 };
+    } else if (transport == TRANSPORT_EVENTFD) {
+        int to_child = eventfd(0, 0);
+        int to_parent = eventfd(0, 0);
+        if (to_child == -1 || to_parent == -1) {
+            perror("eventfd failed");
+            exit(EXIT_FAILURE);
+        }
+        c->ping = (direction_t){ to_child, to_child, 0 };
+        c->pong = (direction_t){ to_parent, to_parent, 0 };
+    } else {
+        c->turn = mmap(NULL, sizeof(*c->turn), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (c->turn == MAP_FAILED) {
+            perror("mmap failed");
+            exit(EXIT_FAILURE);
+        }
+        atomic_store(c->turn, 0);
+        c->ping = (direction_t){ -1, -1, 1 };
+        c->pong = (direction_t){ -1, -1, 0 };
+    }
+}
+
+// after the fork, close the ends the other side uses, so either side sees end of file if the
+// other one dies (an eventfd or the futex word is shared by both and has no ends to close)
+static void channel_keep(channel_t *c, bool parent) {
+    if (c->transport == TRANSPORT_PIPE) {
+        close(parent ? c->ping.rd : c->ping.wr);
+        close(parent ? c->pong.wr : c->pong.rd);
+    } else if (c->transport == TRANSPORT_SOCKET) {
+        close(parent ? c->ping.rd : c->ping.wr);
+    }
+}
+
+// parent side teardown, once the child has exited
+static void channel_close(channel_t *c) {
+    if (c->transport == TRANSPORT_FUTEX) {
+        munmap(c->turn, sizeof(*c->turn));
+        return;
+    }
+    close(c->ping.wr);
+    if (c->transport != TRANSPORT_SOCKET) {
+        close(c->pong.rd);
+    }
+}
+
+// hand the turn to the other side
+static void channel_signal(channel_t *c, direction_t *d) {
+    if (c->transport == TRANSPORT_FUTEX) {
+        atomic_store_explicit(c->turn, d->turn, memory_order_release);
+        futex(c->turn, FUTEX_WAKE, 1);
+        return;
+    }
+    uint64_t one = 1;
+    // an eventfd takes an 8 byte counter increment, the others a single byte
+    size_t len = (c->transport == TRANSPORT_EVENTFD) ? sizeof(one) : 1;
+    if (write(d->wr, &one, len) != (ssize_t)len) {
+        perror("signal write failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+// block until the other side hands the turn over
+static void channel_wait(channel_t *c, direction_t *d) {
+    if (c->transport == TRANSPORT_FUTEX) {
+        uint32_t cur;
+        while ((cur = atomic_load_explicit(c->turn, memory_order_acquire)) != d->turn) {
+            futex(c->turn, FUTEX_WAIT, cur);
+        }
+        return;
+    }
+    uint64_t value;
+    size_t len = (c->transport == TRANSPORT_EVENTFD) ? sizeof(value) : 1;
+    if (read(d->rd, &value, len) != (ssize_t)len) {
+        perror("wait read failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// time trips round trips over one transport, each side optionally pinned, and print the
+// distribution; the first WARMUP_TRIPS are run but not recorded
+static void latency_run(int transport, long trips, int parent_cpu, int child_cpu) {
+    channel_t c;
+    channel_open(&c, transport);
+    uint64_t *samples = malloc(trips * sizeof(uint64_t));
+    if (samples == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork failed");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        channel_keep(&c, false);
+        pin_cpu(child_cpu);
+        for (long i = 0; i < trips + WARMUP_TRIPS; i++) {
+            channel_wait(&c, &c.ping);
+            channel_signal(&c, &c.pong);
+        }
+        exit(EXIT_SUCCESS);
+    }
+
+    channel_keep(&c, true);
+    pin_cpu(parent_cpu);
+    for (long i = 0; i < trips + WARMUP_TRIPS; i++) {
+        uint64_t start = now_ns();
+        channel_signal(&c, &c.ping);
+        channel_wait(&c, &c.pong);
+        if (i >= WARMUP_TRIPS) {
+            samples[i - WARMUP_TRIPS] = now_ns() - start;
+        }
+    }
+    waitpid(pid, NULL, 0);
+    channel_close(&c);
+
+    qsort(samples, trips, sizeof(uint64_t), compare_u64);
+    printf("%-10s min %6lu  p50 %6lu  p99 %7lu  p99.9 %7lu  max %8lu ns  (%ld round trips)\n",
+           transport_names[transport], (unsigned long)samples[0],
+           (unsigned long)samples[trips / 2], (unsigned long)samples[(long)(trips * 0.99)],
+           (unsigned long)samples[(long)(trips * 0.999)], (unsigned long)samples[trips - 1], trips);
+    free(samples);
+}
+
+// write all of len bytes, however many calls the pipe takes
+static void write_all(int fd, const void *buffer, size_t len) {
+    const char *p = buffer;
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("write failed");
+            exit(EXIT_FAILURE);
+        }
+        p += n;
+        len -= n;
+    }
+}
+
+// child side of an rpc run: read whatever requests have arrived, answer all of them with a
+// single write, and loop until the parent closes the request pipe
+static void rpc_server(int rd, int wr) {
+    char *in = malloc(RPC_BUFFER);
+    rpc_frame_t *out = malloc(RPC_BUFFER);
+    if (in == NULL || out == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t have = 0;
+    for (;;) {
+        ssize_t n = read(rd, in + have, RPC_BUFFER - have);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("request read failed");
+            exit(EXIT_FAILURE);
+        }
+        if (n == 0) {
+            break;
+        }
+        have += n;
+
+        size_t frames = have / sizeof(rpc_frame_t);
+        for (size_t i = 0; i < frames; i++) {
+            rpc_frame_t *req = (rpc_frame_t *)in + i;
+            if (req->len != RPC_PAYLOAD) {
+                fprintf(stderr, "Error: request %u has a %u byte payload\n", req->id, req->len);
+                exit(EXIT_FAILURE);
+            }
+            out[i].id = req->id;
+            out[i].len = req->len;
+            for (int b = 0; b < RPC_PAYLOAD; b++) {
+                out[i].payload[b] = req->payload[b] + 1;
+            }
+        }
+        if (frames > 0) {
+            write_all(wr, out, frames * sizeof(rpc_frame_t));
+        }
+        // keep a partial frame for the next read
+        have -= frames * sizeof(rpc_frame_t);
+        memmove(in, in + frames * sizeof(rpc_frame_t), have);
+    }
+    if (have != 0) {
+        fprintf(stderr, "Error: request pipe closed inside a frame\n");
+        exit(EXIT_FAILURE);
+    }
+    free(in);
+    free(out);
+}
+
+// grow a pipe so it holds at least bytes unread; with no more than a window of frames unread
+// in either direction, neither side can then block in write while the other does too
+static void rpc_size_pipe(int fd, size_t bytes) {
+    int size = fcntl(fd, F_GETPIPE_SZ);
+    if (size < 0) {
+        perror("F_GETPIPE_SZ failed");
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)size >= bytes) {
+        return;
+    }
+    if (bytes > (size_t)pipe_max_size() || fcntl(fd, F_SETPIPE_SZ, (int)bytes) < 0) {
+        fprintf(stderr, "Error: a window of this size needs a %zu KB pipe, above %s\n",
+                bytes / 1024, PIPE_MAX_SIZE);
+        exit(EXIT_FAILURE);
+    }
+}
+
+// send requests over a fresh pipe pair, keeping up to window of them unanswered, check every
+// reply against the request it names, and print the request rate
+static void rpc_run(long requests, int window, int parent_cpu, int child_cpu) {
+    int to_child[2], to_parent[2];
+    if (pipe(to_child) == -1 || pipe(to_parent) == -1) {
+        perror("pipe creation failed");
+        exit(EXIT_FAILURE);
+    }
+    // one page over the window covers a frame split across the pipe's page buffers
+    size_t bytes = (size_t)window * sizeof(rpc_frame_t) + 4096;
+    rpc_size_pipe(to_child[1], bytes);
+    rpc_size_pipe(to_parent[1], bytes);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork failed");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        close(to_child[1]);
+        close(to_parent[0]);
+        pin_cpu(child_cpu);
+        rpc_server(to_child[0], to_parent[1]);
+        exit(EXIT_SUCCESS);
+    }
+    close(to_child[0]);
+    close(to_parent[1]);
+    pin_cpu(parent_cpu);
+
+    rpc_frame_t *out = malloc((size_t)window * sizeof(rpc_frame_t));
+    char *in = malloc((size_t)window * sizeof(rpc_frame_t));
+    if (out == NULL || in == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    uint32_t sent = 0;     // id of the next request
+    uint32_t answered = 0; // id of the next reply expected; replies come back in order
+    size_t have = 0;
+    uint64_t start = now_ns();
+    while (answered < requests) {
+        // top the window up with one write
+        int n = 0;
+        while (sent < requests && sent - answered < (uint32_t)window) {
+            out[n].id = sent;
+            out[n].len = RPC_PAYLOAD;
+            memset(out[n].payload, (unsigned char)sent, RPC_PAYLOAD);
+            sent++;
+            n++;
+        }
+        if (n > 0) {
+            write_all(to_child[1], out, n * sizeof(rpc_frame_t));
+        }
+
+        // then take whatever replies are there, waiting for at least one
+        ssize_t r = read(to_parent[0], in + have, (size_t)window * sizeof(rpc_frame_t) - have);
+        if (r < 0 && errno == EINTR) continue;
+        if (r <= 0) {
+            perror("reply read failed");
+            exit(EXIT_FAILURE);
+        }
+        have += r;
+        size_t frames = have / sizeof(rpc_frame_t);
+        for (size_t i = 0; i < frames; i++) {
+            rpc_frame_t *reply = (rpc_frame_t *)in + i;
+            if (reply->id != answered || reply->len != RPC_PAYLOAD ||
+                reply->payload[0] != (unsigned char)(answered + 1)) {
+                fprintf(stderr, "Error: reply %u does not answer request %u\n", reply->id, answered);
+                exit(EXIT_FAILURE);
+            }
+            answered++;
+        }
+        have -= frames * sizeof(rpc_frame_t);
+        memmove(in, in + frames * sizeof(rpc_frame_t), have);
+    }
+    double secs = (now_ns() - start) / 1e9;
+
+    close(to_child[1]);
+    waitpid(pid, NULL, 0);
+    close(to_parent[0]);
+    free(out);
+    free(in);
+    printf("window %5d  %12.0f requests/s  %8.1f ns/request  (%ld requests)\n",
+           window, requests / secs, secs * 1e9 / requests, requests);
+}
+
+// the original exchange: one message from parent to child and one back
+static void exchange_messages() {
     int pipe_parent_to_child[2]; // pipe for parent to child communication
     int pipe_child_to_parent[2]; // pipe for child to parent communication
     pid_t pid;
     char buffer[100];
-    
+
     // Create both pipes
     if (pipe(pipe_parent_to_child) == -1 || pipe(pipe_child_to_parent) == -1) {
         perror("pipe creation failed");
         exit(EXIT_FAILURE);
     }
-    
+
     // forking process
     pid = fork();
-    
+
     if (pid < 0) {
         perror("fork failed");
         exit(EXIT_FAILURE);
     }
-    
+
     if (pid > 0) {
         // close unused pipe ends
-        // 0 is read end 
+        // 0 is read end
         // 1 is write end
         close(pipe_parent_to_child[0]); // close read end of parent->child pipe
         close(pipe_child_to_parent[1]); // close write end of child->parent pipe
-        
+
         // prepare and send message to child
         snprintf(buffer, sizeof(buffer), "I am your daddy! and my name is %d\n", getpid());
         write(pipe_parent_to_child[1], buffer, strlen(buffer) + 1);
-        
+
         // wait for message from child
         read(pipe_child_to_parent[0], buffer, sizeof(buffer));
         printf("%s\n", buffer);
-        
+
         // close remaining pipe ends
         close(pipe_parent_to_child[1]);
         close(pipe_child_to_parent[0]);
-        
+
         // wait for child to exit to prevent zombie process
         int status;
         waitpid(pid, &status, 0);
-        
-    } else { 
+
+    } else {
         // Close unused pipe ends
         close(pipe_parent_to_child[1]); // close write end of parent->child pipe
         close(pipe_child_to_parent[0]); // close read end of child->parent pipe
-        
+
         // read message from parent
         read(pipe_parent_to_child[0], buffer, sizeof(buffer));
         printf("%s", buffer); // print message from parent verbatim
-        
+
         // prepare and send message to parent
         snprintf(buffer, sizeof(buffer), "Daddy, my name is %d", getpid());
         write(pipe_child_to_parent[1], buffer, strlen(buffer) + 1);
-        
+
         // close remaining pipe ends
         close(pipe_parent_to_child[0]);
         close(pipe_child_to_parent[1]);
-        
+
         exit(EXIT_SUCCESS);
     }
-    
+}
+
+int main(int argc, char *argv[]) {
+    bool bulk = false;
+    size_t volume = DEFAULT_VOLUME;
+    size_t chunk = 0;
+    int method = -1;     // -1 runs every method
+    int pipe_size = -1;  // -1 runs both the default and the largest allowed pipe
+    long trips = 0;      // -L round trips; 0 leaves latency mode off
+    int transport = -1;  // -1 runs every transport
+    int parent_cpu = -1;
+    int child_cpu = -1;
+    long requests = 0;   // -R requests per window; 0 leaves rpc mode off
+    char default_windows[] = DEFAULT_WINDOWS;
+    char *window_list = default_windows; // strtok writes into it
+    int c;
+
+    while ((c = getopt(argc, argv, "B:m:P:c:L:t:C:R:W:")) != -1) {
+        switch (c) {
+            case 'B':
+                bulk = true;
+                volume = parse_size(optarg);
+                if (volume == 0) {
+                    fprintf(stderr, "Error: -B volume must be at least 1 byte\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'm':
+                for (int i = 0; i < 3; i++) {
+                    if (strcmp(optarg, method_names[i]) == 0) {
+                        method = i;
+                    }
+                }
+                if (method < 0) {
+                    fprintf(stderr, "Error: -m must be rw, vmsplice or splice\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'P':
+                // 0 keeps the default size
+                pipe_size = parse_size(optarg);
+                break;
+            case 'c':
+                chunk = parse_size(optarg);
+                if (chunk == 0) {
+                    fprintf(stderr, "Error: -c chunk must be at least 1 byte\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'L':
+                trips = strtol(optarg, NULL, 10);
+                if (trips < 1) {
+                    fprintf(stderr, "Error: -L round trips must be at least 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 't':
+                for (int i = 0; i < 4; i++) {
+                    if (strcmp(optarg, transport_names[i]) == 0) {
+                        transport = i;
+                    }
+                }
+                if (transport < 0) {
+                    fprintf(stderr, "Error: -t must be pipe, socketpair, eventfd or futex\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'C':
+                // parent and child cpu, e.g. -C 0,2 (the same cpu for both is allowed)
+                if (sscanf(optarg, "%d,%d", &parent_cpu, &child_cpu) != 2 || parent_cpu < 0 || child_cpu < 0) {
+                    fprintf(stderr, "Error: -C must be <parent cpu>,<child cpu>\n");
+                    exit(EXIT_FAILURE);
+                }
+                // refuse cpus we may not run on here rather than in a child the parent waits for
+                cpu_set_t allowed;
+                if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1 ||
+                    parent_cpu >= CPU_SETSIZE || child_cpu >= CPU_SETSIZE ||
+                    !CPU_ISSET(parent_cpu, &allowed) || !CPU_ISSET(child_cpu, &allowed)) {
+                    fprintf(stderr, "Error: -C cpus must be online and allowed for this process\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'R':
+                requests = strtol(optarg, NULL, 10);
+                if (requests < 1 || requests > UINT32_MAX) {
+                    fprintf(stderr, "Error: -R requests must be between 1 and %u\n", UINT32_MAX);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'W':
+                window_list = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-B <volume>[K|M|G] [-m rw|vmsplice|splice] [-P <pipe size>] [-c <chunk>]] [-L <round trips> [-t pipe|socketpair|eventfd|futex]] [-R <requests> [-W <window>[,<window>...]]] [-C <parent cpu>,<child cpu>]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (trips > 0) {
+        if (parent_cpu >= 0) {
+            printf("Parent on cpu %d, child on cpu %d\n", parent_cpu, child_cpu);
+        }
+        for (int t = 0; t < 4; t++) {
+            if (transport >= 0 && t != transport) continue;
+            latency_run(t, trips, parent_cpu, child_cpu);
+        }
+    }
+    if (requests > 0) {
+        int windows[MAX_WINDOWS];
+        int nwindows = 0;
+        for (char *w = strtok(window_list, ","); w != NULL; w = strtok(NULL, ",")) {
+            if (nwindows == MAX_WINDOWS || (windows[nwindows] = atoi(w)) < 1) {
+                fprintf(stderr, "Error: -W takes up to %d windows of at least 1\n", MAX_WINDOWS);
+                exit(EXIT_FAILURE);
+            }
+            nwindows++;
+        }
+        printf("Pipelined rpc, %zu byte frames\n", sizeof(rpc_frame_t));
+        for (int w = 0; w < nwindows; w++) {
+            rpc_run(requests, windows[w], parent_cpu, child_cpu);
+        }
+    }
+    if (!bulk) {
+        if (trips == 0 && requests == 0) {
+            exchange_messages();
+        }
+        return 0;
+    }
+
+    int sizes[2] = { 0, pipe_max_size() };
+    int nsizes = 2;
+    if (pipe_size >= 0) {
+        sizes[0] = pipe_size;
+        nsizes = 1;
+    }
+    printf("Streaming %zu MB parent -> child\n", volume >> 20);
+    for (int m = 0; m < 3; m++) {
+        if (method >= 0 && m != method) continue;
+        for (int s = 0; s < nsizes; s++) {
+            bulk_run(m, sizes[s], volume, chunk);
+        }
+    }
     return 0;
-}
\ No newline at end of file
+}
@@ -1,111 +1,238 @@
+#define _GNU_SOURCE
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <signal.h>
 #include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+// Handoff mechanisms: how one thread passes the turn to the other and wakes it
+#define HANDOFF_MUTEX 0   // mutex plus one condition variable per thread
+#define HANDOFF_FUTEX 1   // futex wait/wake on an atomic turn word
+#define HANDOFF_SPIN 2    // spin on the atomic turn word with a pause instruction, never sleep
+#define HANDOFF_EVENTFD 3 // one eventfd per thread, written to hand it the turn
+const char *handoff_names[] = {"mutex", "futex", "spin", "eventfd"};
+
+#define TURN_STOPPED 0 // set on SIGINT so no futex waiter sleeps on a stale turn
 
 // Global variables for thread synchronization
 pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 pthread_cond_t cond1 = PTHREAD_COND_INITIALIZER;
 pthread_cond_t cond2 = PTHREAD_COND_INITIALIZER;
-volatile int thread1_go = 1; // Initially thread 1 starts
-volatile int thread2_go = 0;
+_Atomic uint32_t turn = 1; // Initially thread 1 starts
+int event_fd[3];           // indexed by thread number, 0 unused
+int handoff = HANDOFF_MUTEX;
+long rounds = 0;           // -n round trips; 0 pings and pongs with output until SIGINT
 volatile int running = 1; // Flag to control thread execution
 
+// -m spin: the waiting thread re-reads turn in a tight loop; hint the CPU so it does not
+// flood the pipeline while the other thread is about to flip it
+static inline void cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static long futex(_Atomic uint32_t *addr, int op, uint32_t val) {
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+// Give the turn to thread `to` and wake it
+static void handoff_give(int to) {
+    uint64_t one = 1;
+    switch (handoff) {
+        case HANDOFF_MUTEX:
+            pthread_mutex_lock(&mutex);
+            atomic_store_explicit(&turn, to, memory_order_relaxed);
+            pthread_cond_signal(to == 1 ? &cond1 : &cond2);
+            pthread_mutex_unlock(&mutex);
+            break;
+        case HANDOFF_FUTEX:
+            atomic_store_explicit(&turn, to, memory_order_release);
+            futex(&turn, FUTEX_WAKE_PRIVATE, 1);
+            break;
+        case HANDOFF_SPIN:
+            atomic_store_explicit(&turn, to, memory_order_release);
+            break;
+        case HANDOFF_EVENTFD:
+            if (write(event_fd[to], &one, sizeof(one)) != sizeof(one)) {
+                perror("eventfd write failed");
+                exit(EXIT_FAILURE);
+            }
+            break;
+    }
+}
+
+// Wait until it's thread `me`'s turn; returns 0 if the program is stopping instead
+static int handoff_wait(int me) {
+    uint32_t cur;
+    uint64_t value;
+    switch (handoff) {
+        case HANDOFF_MUTEX:
+            pthread_mutex_lock(&mutex);
+            while (atomic_load_explicit(&turn, memory_order_relaxed) != (uint32_t)me && running) {
+                pthread_cond_wait(me == 1 ? &cond1 : &cond2, &mutex);
+            }
+            pthread_mutex_unlock(&mutex);
+            break;
+        case HANDOFF_FUTEX:
+            while ((cur = atomic_load_explicit(&turn, memory_order_acquire)) != (uint32_t)me && running) {
+                futex(&turn, FUTEX_WAIT_PRIVATE, cur);
+            }
+            break;
+        case HANDOFF_SPIN:
+            while (atomic_load_explicit(&turn, memory_order_acquire) != (uint32_t)me && running) {
+                cpu_relax();
+            }
+            break;
+        case HANDOFF_EVENTFD:
+            if (read(event_fd[me], &value, sizeof(value)) != sizeof(value)) {
+                perror("eventfd read failed");
+                exit(EXIT_FAILURE);
+            }
+            break;
+    }
+    return running;
+}
+
 // Signal handler for SIGINT
 void handle_sigint(int sig) {
+    uint64_t one = 1;
     running = 0;
-    // Signal both threads to check running state
-    pthread_cond_signal(&cond1);
-    pthread_cond_signal(&cond2);
+    // Wake both threads to check running state
+    switch (handoff) {
+        case HANDOFF_MUTEX:
+            pthread_cond_signal(&cond1);
+            pthread_cond_signal(&cond2);
+            break;
+        case HANDOFF_FUTEX:
+            atomic_store(&turn, TURN_STOPPED);
+            futex(&turn, FUTEX_WAKE_PRIVATE, 2);
+            break;
+        case HANDOFF_EVENTFD:
+            write(event_fd[1], &one, sizeof(one));
+            write(event_fd[2], &one, sizeof(one));
+            break;
+    }
 }
 
-// Thread 1 function
+// Thread 1 function: pings, then waits for the pong; in counted mode it also times the run
 void *thread1_func(void *arg) {
-    while (running) {
-        pthread_mutex_lock(&mutex);
-        // Wait until it's thread 1's turn or program is stopping
-        while (!thread1_go && running) {
-            pthread_cond_wait(&cond1, &mutex);
+    uint64_t start = now_ns();
+    for (long i = 0; running && (rounds == 0 || i < rounds); i++) {
+        if (rounds == 0) {
+            // First output - ping
+            printf("thread 1: ping thread 2\n");
+            fflush(stdout);
         }
-        
-        if (!running) {
-            pthread_mutex_unlock(&mutex);
+
+        // Signal thread 2 to go, then wait for thread 2 to signal back
+        handoff_give(2);
+        if (!handoff_wait(1)) {
             break;
         }
-        
-        // First output - ping
-        printf("thread 1: ping thread 2\n");
-        fflush(stdout);
-        
-        // Signal thread 2 to go
-        thread1_go = 0;
-        thread2_go = 1;
-        pthread_cond_signal(&cond2);
-        
-        // Wait for thread 2 to signal back
-        while (!thread1_go && running) {
-            pthread_cond_wait(&cond1, &mutex);
-        }
-        
-        if (!running) {
-            pthread_mutex_unlock(&mutex);
-            break;
+
+        if (rounds == 0) {
+            // Second output - pong response
+            printf("thread 1: pong! thread 2 ping received\n");
+            fflush(stdout);
         }
-        
-        // Second output - pong response
-        printf("thread 1: pong! thread 2 ping received\n");
-        fflush(stdout);
-        
-        pthread_mutex_unlock(&mutex);
-    }
-    
+    }
+    *(uint64_t *)arg = now_ns() - start;
     return NULL;
 }
 
 // Thread 2 function
 void *thread2_func(void *arg) {
-    while (running) {
-        pthread_mutex_lock(&mutex);
+    for (long i = 0; running && (rounds == 0 || i < rounds); i++) {
         // Wait until it's thread 2's turn or program is stopping
-        while (!thread2_go && running) {
-            pthread_cond_wait(&cond2, &mutex);
-        }
-        
-        if (!running) {
-            pthread_mutex_unlock(&mutex);
+        if (!handoff_wait(2)) {
             break;
         }
-        
-        // First output - pong response
-        printf("thread 2: pong! thread 1 ping received\n");
-        fflush(stdout);
-        
-        // Second output - ping
-        printf("thread 2: ping thread 1\n");
-        fflush(stdout);
-        
+
+        if (rounds == 0) {
+            // First output - pong response
+            printf("thread 2: pong! thread 1 ping received\n");
+            fflush(stdout);
+
+            // Second output - ping
+            printf("thread 2: ping thread 1\n");
+            fflush(stdout);
+        }
+
         // Signal thread 1 to go
-        thread2_go = 0;
-        thread1_go = 1;
-        pthread_cond_signal(&cond1);
-        pthread_mutex_unlock(&mutex);
+        handoff_give(1);
     }
-    
     return NULL;
 }
 
-int main() {
+int main(int argc, char *argv[]) {
     pthread_t thread1, thread2;
+    uint64_t elapsed_ns = 0;
     int rc;
+    int c;
+
+    while ((c = getopt(argc, argv, "m:n:")) != -1) {
+        switch (c) {
+            case 'm':
+                handoff = -1;
+                for (int i = 0; i < 4; i++) {
+                    if (strcmp(optarg, handoff_names[i]) == 0) {
+                        handoff = i;
+                    }
+                }
+                if (handoff < 0) {
+                    fprintf(stderr, "Error: -m must be mutex, futex, spin or eventfd\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'n':
+                rounds = strtol(optarg, NULL, 10);
+                if (rounds < 1) {
+                    fprintf(stderr, "Error: -n round trips must be at least 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-m mutex|futex|spin|eventfd] [-n <round trips>]\n", argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    if (handoff == HANDOFF_EVENTFD) {
+        event_fd[1] = eventfd(0, 0);
+        event_fd[2] = eventfd(0, 0);
+        if (event_fd[1] == -1 || event_fd[2] == -1) {
+            perror("eventfd failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // Set up signal handler using basic signal() function
     if (signal(SIGINT, handle_sigint) == SIG_ERR) {
         fprintf(stderr, "Cannot set signal handler\n");
         return EXIT_FAILURE;
     }
-    
+
     // Create threads
-    rc = pthread_create(&thread1, NULL, thread1_func, NULL);
+    rc = pthread_create(&thread1, NULL, thread1_func, &elapsed_ns);
     if(rc !=0){
         fprintf(stderr, "Error creating thread 1: %d\n", rc);
         exit(EXIT_FAILURE);
@@ -115,25 +242,38 @@ int main() {
         fprintf(stderr, "Error creating thread 2: %d\n", rc);
         exit(EXIT_FAILURE);
     }
-    // Wait for threads to complete (which will happen when SIGINT is received)
+    // Wait for threads to complete (after -n round trips, or when SIGINT is received)
     rc = pthread_join(thread1, NULL);
     if (rc != 0) {
         fprintf(stderr, "Error joining thread 1: %d\n", rc);
         return EXIT_FAILURE;
     }
-    
+
     rc = pthread_join(thread2, NULL);
     if (rc != 0) {
         fprintf(stderr, "Error joining thread 2: %d\n", rc);
         return EXIT_FAILURE;
     }
-    
+
+    if (rounds > 0 && running) {
+        // Two handoffs per round trip: thread 1 -> thread 2 and back
+        double handoffs = 2.0 * rounds;
+        printf("%-8s %ld round trips in %.3f s: %.0f handoffs/s, %.1f ns/handoff\n",
+               handoff_names[handoff], rounds, elapsed_ns / 1e9,
+               handoffs * 1e9 / elapsed_ns, elapsed_ns / handoffs);
+    }
+
     // Clean up resources
+    if (handoff == HANDOFF_EVENTFD) {
+        close(event_fd[1]);
+        close(event_fd[2]);
+    }
+
     if ((rc = pthread_mutex_destroy(&mutex)) != 0) {
         fprintf(stderr, "Error destroying mutex: %d\n", rc);
         return EXIT_FAILURE;
     }
-    
+
     if ((rc = pthread_cond_destroy(&cond1)) != 0) {
         fprintf(stderr, "Error destroying condition variable: %d\n", rc);
         return EXIT_FAILURE;
@@ -143,4 +283,4 @@ int main() {
         return EXIT_FAILURE;
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,111 @@
+#!/bin/bash
+# Benchmark matrix for ipcshared: Unix socket (-u) vs shared memory (-s) across message
+# size, queue depth and producer count. Every run prints one JSON line (JSON Lines overall)
+# with msgs/sec, bytes/sec and p50/p99/p99.9 latency taken from the producers' send stamps.
+#
+# TRANSPORTS may also include f, the -u -F memfd descriptor-passing mode, which suits large SIZES,
+# and U, the -u -k -U io_uring streaming backend.
+#
+# Usage: ./bench_ipcshared.sh > results.jsonl
+# Override the matrix through the environment, e.g. SIZES="64 1000" PRODUCERS="1 4" ./bench_ipcshared.sh
+# CLOCK=tsc stamps with the TSC instead of CLOCK_MONOTONIC.
+# ipcshared.c is compiled afresh for every run of the script unless BIN names a binary to use.
+# SHM_MODE spsc, bytes and bcast take one producer, so their runs with more are skipped.
+
+TRANSPORTS=${TRANSPORTS:-"u s"}
+SIZES=${SIZES:-"64 512 1000"}
+DEPTHS=${DEPTHS:-"16 256"}
+PRODUCERS=${PRODUCERS:-"1 4"}
+MESSAGES=${MESSAGES:-20000}
+SHM_MODE=${SHM_MODE:-mpmc}
+WAIT=${WAIT:-park}
+BATCH=${BATCH:-1}
+CLOCK=${CLOCK:-mono}
+
+if [ -z "$BIN" ]; then
+    build=$(mktemp -d)
+    trap 'rm -rf "$build"' EXIT
+    BIN=$build/ipcshared
+    if ! ${CC:-gcc} -O2 -o "$BIN" "$(dirname "$0")/ipcshared.c" -lpthread; then
+        echo "Error: could not build ipcshared.c; set BIN to a built binary instead" >&2
+        exit 1
+    fi
+elif [ ! -x "$BIN" ]; then
+    echo "Error: $BIN not found, build it with: gcc -O2 -o ipcshared ipcshared.c -lpthread" >&2
+    exit 1
+fi
+
+# wait until the consumer says it is listening (or attached to the segment) before starting
+# producers; fails if it exits first
+wait_ready() {
+    local out=$1 pid=$2
+    until grep -q '^Consumer started' "$out"; do
+        if ! kill -0 "$pid" 2>/dev/null; then
+            echo "Error: consumer exited before it was ready" >&2
+            cat "$out" >&2
+            return 1
+        fi
+        sleep 0.01
+    done
+}
+
+run_one() {
+    local t=$1 size=$2 depth=$3 producers=$4 out
+    if [ "$t" = s ] && [ "$producers" -gt 1 ]; then
+        case "$SHM_MODE" in
+            spsc|bytes|bcast)
+                echo "Skipping -M $SHM_MODE with $producers producers: it takes one" >&2
+                return
+                ;;
+        esac
+    fi
+    out=$(mktemp)
+    if [ "$t" = s ]; then
+        # start from a fresh segment, which the consumer creates from its own -q and -M
+        rm -f /dev/shm/pc_shm /dev/shm/sem.sem_full /dev/shm/sem.sem_empty /dev/shm/sem.sem_mutex
+        "$BIN" -c -s -q "$depth" -M "$SHM_MODE" -j -Y "$CLOCK" -w "$WAIT" -P "$producers" > "$out" &
+    elif [ "$t" = f ]; then
+        rm -f /tmp/pc.sock
+        "$BIN" -c -u -F -j -Y "$CLOCK" -l 128 > "$out" &
+    elif [ "$t" = U ]; then
+        rm -f /tmp/pc.sock
+        "$BIN" -c -u -k -U -j -Y "$CLOCK" -P "$producers" > "$out" &
+    else
+        rm -f /tmp/pc.sock
+        "$BIN" -c -u -k -E -j -Y "$CLOCK" -l 128 -P "$producers" > "$out" &
+    fi
+    local consumer=$!
+    if ! wait_ready "$out" "$consumer"; then
+        rm -f "$out"
+        return
+    fi
+
+    local pids=""
+    for ((i = 0; i < producers; i++)); do
+        if [ "$t" = s ]; then
+            "$BIN" -p -s -q "$depth" -M "$SHM_MODE" -w "$WAIT" -b "$BATCH" -n "$MESSAGES" -z "$size" -j -Y "$CLOCK" > /dev/null &
+        elif [ "$t" = f ]; then
+            "$BIN" -p -u -F -q "$depth" -n "$MESSAGES" -z "$size" -j -Y "$CLOCK" > /dev/null &
+        elif [ "$t" = U ]; then
+            "$BIN" -p -u -k -U -q "$depth" -b "$BATCH" -n "$MESSAGES" -z "$size" -j -Y "$CLOCK" > /dev/null &
+        else
+            "$BIN" -p -u -k -q "$depth" -b "$BATCH" -n "$MESSAGES" -z "$size" -j -Y "$CLOCK" > /dev/null &
+        fi
+        pids="$pids $!"
+    done
+    wait $pids
+    wait "$consumer"
+
+    grep '^{' "$out" | sed "s/^{/{\"producers\":$producers,\"size\":$size,\"depth\":$depth,/"
+    rm -f "$out"
+}
+
+for t in $TRANSPORTS; do
+    for size in $SIZES; do
+        for depth in $DEPTHS; do
+            for producers in $PRODUCERS; do
+                run_one "$t" "$size" "$depth" "$producers"
+            done
+        done
+    done
+done
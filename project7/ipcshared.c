@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -14,6 +15,18 @@
 #include <getopt.h>
 #include <sys/select.h>  
 #include <sys/time.h> 
+#include <sys/uio.h>
+#include <sys/epoll.h>
+#include <sys/file.h>
+#include <time.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sched.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <linux/io_uring.h>
 
 
 //constant definitions
@@ -24,22 +37,482 @@
 #define SEM_EMPTY "/sem_empty"
 #define SEM_MUTEX "/sem_mutex"
 
+//-t named channels: each channel has its own segment, semaphores and socket, named after the
+//topic, and is listed in a directory segment guarded by its own semaphore
+#define DIR_NAME "/pc_dir"
+#define SEM_DIR "/sem_dir"
+#define MAX_CHANNELS 64
+#define CHANNEL_NAME 32
+
+//-k streaming socket mode: frames are a uint32_t length followed by the payload, written
+//STREAM_FRAMES at a time with writev unless -b asks for another count
+#define STREAM_FRAMES 64
+#define STREAM_BUFFER 65536
+#define STREAM_IOV 1024
+//-E consumer: most producer connections held open at once
+#define MAX_CONNS 1024
+
+//-i record input: read() buffer for pipes and stdin (regular files are mapped whole), and -o
+//output: iovecs gathered per writev to stdout
+#define IN_BUFFER (1 << 20)
+#define OUT_IOV 1024
+
+//-U io_uring transport, driven through the raw syscalls: the consumer keeps one multishot
+//accept and one multishot recv per connection armed, receiving into a ring of URING_BUFS
+//provided buffers; the producer streams frames from two registered staging buffers
+#define URING_ENTRIES 256
+#define URING_BUFS 256
+#define URING_BUF_SIZE 16384
+#define URING_BGID 1
+#define URING_STAGE (4 * STREAM_BUFFER)
+#define URING_ACCEPT UINT64_MAX
+
+//-F: payloads travel in sealed memfds passed with SCM_RIGHTS; the socket carries only the
+//length, and -e prints at most PAYLOAD_PREVIEW bytes of each payload
+#define PAYLOAD_SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+#define PAYLOAD_PREVIEW 64
+
+//queue modes selectable with -M, stored in the shared segment so attachers agree
+#define QUEUE_SEM 0
+#define QUEUE_SPSC 1
+#define QUEUE_MPMC 2
+#define QUEUE_BYTES 3
+#define QUEUE_BCAST 4
+const char *queue_mode_names[] = {"sem", "spsc", "mpmc", "bytes", "bcast"};
+
+//QUEUE_BCAST: every registered consumer reads every message through its own cursor
+#define MAX_CURSORS 16
+//how often a QUEUE_BCAST producer waiting for room checks for cursors left by dead consumers
+#define CURSOR_CHECK_MS 100
+
+//QUEUE_BYTES record header; records are padded to RECORD_ALIGN and a RECORD_PAD length
+//tells the consumer to skip the rest of the ring and continue at offset 0
+#define RECORD_ALIGN 8
+#define RECORD_PAD 0xFFFFFFFFu
+
+//wait policies selectable with -w for a full (producer) or empty (consumer) queue
+#define WAIT_SPIN 0
+#define WAIT_YIELD 1
+#define WAIT_PARK 2
+#define WAIT_BLOCK 3
+#define SPIN_LIMIT 1024
+
+//back-pressure policies selectable with -O for a producer that finds the ring full: wait for
+//room, drop the new messages, or (QUEUE_SPSC only) overwrite the oldest unread ones
+#define POLICY_BLOCK 0
+#define POLICY_DROP 1
+#define POLICY_OVERWRITE 2
+
 sem_t *full;
 sem_t *empty;
 sem_t *mutex;
 
+//futex word living in the shared segment plus a count of parked waiters, so notifying
+//costs a fence and a load unless somebody is actually asleep on it
+typedef struct{
+    _Atomic uint32_t seq;
+    _Atomic uint32_t waiters;
+}waitword_t;
+
+//segment header identification; bump QUEUE_VERSION whenever queue_t changes layout
+#define QUEUE_MAGIC 0x50435348u
+#define QUEUE_VERSION 9
+#define CACHE_LINE 64
+
+//one QUEUE_BCAST consumer's read position, on a cache line of its own; owner is the pid that
+//registered it, so the producer can reclaim the cursor of a consumer that died holding it
+typedef struct{
+    _Alignas(CACHE_LINE) _Atomic uint64_t pos;
+    _Atomic int active;
+    _Atomic int owner;
+}cursor_t;
+
+//live counters kept in the segment with relaxed atomics and read by -S; each side writes only
+//its own cache line. Occupancy is in messages, or bytes for QUEUE_BYTES. dropped and
+//overwritten are what the producers discarded under -O; gaps and lost are what the consumer
+//found missing from the sequence when it was overwritten
+typedef struct{
+    _Alignas(CACHE_LINE) _Atomic uint64_t enqueued;
+    _Atomic uint64_t bytes_in;
+    _Atomic uint64_t full_waits;
+    _Atomic uint64_t full_wait_ns;
+    _Atomic uint64_t high_water;
+    _Atomic uint64_t dropped;
+    _Atomic uint64_t overwritten;
+    _Alignas(CACHE_LINE) _Atomic uint64_t dequeued;
+    _Atomic uint64_t bytes_out;
+    _Atomic uint64_t empty_waits;
+    _Atomic uint64_t empty_wait_ns;
+    _Atomic uint64_t gaps;
+    _Atomic uint64_t lost;
+}queue_stats_t;
+
+//-H: back the segment with a hugetlbfs file instead of POSIX shm
+#define HUGE_SHM_PATH "/dev/hugepages/pc_shm"
+#define HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
 //queue struct to store messages and manage producer-consumer shared memory
+//head and tail are atomics so the lock-free modes can publish slots without the mutex;
+//in QUEUE_SPSC they count messages and are reduced modulo q_size to find a slot, in
+//QUEUE_BYTES they count bytes and are reduced modulo ring_bytes. durable is the -J journal's
+//head as of the last group commit, so it never points past records that reached the disk;
+//-J consumers read only up to it. In QUEUE_BCAST tail is the
+//retention floor: the slowest consumer cursor as of the producer's last look, and where a
+//newly registered consumer starts reading. Under POLICY_OVERWRITE head may run more than
+//q_size ahead of tail; the consumer then skips to the oldest message still in the ring.
+//The first line holds the layout, written when the queue is (re)initialised or grown and only
+//read while messages flow. done and the attach counts change as processes come and go, so they
+//get the next line; head (written by producers), tail (written by consumers) and each waitword
+//get a cache line of their own so the two sides do not false-share on every message
 typedef struct{
-    int head;
-    int tail;
+    uint32_t magic;
+    uint32_t version;
     int q_size;
-    int count;
     int running;
-    int done;
-    char messages[BUFFER_SIZE];
+    int mode;
+    int policy;
+    uint64_t ring_bytes;
+    _Alignas(CACHE_LINE) _Atomic int done;
+    _Atomic int producers;
+    _Atomic int finished;
+    _Atomic int consumers;
+    _Alignas(CACHE_LINE) _Atomic uint64_t head;
+    _Atomic uint64_t durable;
+    _Alignas(CACHE_LINE) _Atomic uint64_t tail;
+    _Alignas(CACHE_LINE) waitword_t not_empty;
+    _Alignas(CACHE_LINE) waitword_t not_full;
+    cursor_t cursors[MAX_CURSORS];
+    queue_stats_t stats;
+    _Alignas(CACHE_LINE) char messages[BUFFER_SIZE];
 }queue_t;
 
-queue_t *q_t;
+//QUEUE_MPMC slot: the first bytes of each BUFFER_SIZE slot hold a sequence number that says
+//whether the slot is free for position pos (seq == pos) or holds its message (seq == pos + 1).
+//POLICY_OVERWRITE uses the same layout as a seqlock: seq is 2 * pos + 1 while the message for
+//pos is being written and 2 * pos + 2 once it is published
+typedef struct{
+    _Atomic uint64_t seq;
+    char data[BUFFER_SIZE - sizeof(uint64_t)];
+}slot_t;
+
+typedef struct{
+    uint32_t len;
+    uint32_t reserved;
+}record_t;
+
+//a run of messages handed out in place by queue_reserve or queue_peek and handed back by
+//queue_commit or queue_release; pos and end are ring positions (slots or bytes). lost counts
+//the messages overwritten before a POLICY_OVERWRITE consumer could read them, skipped
+//between the previous run and this one
+#define MAX_BATCH 1024
+typedef struct{
+    uint64_t pos;
+    uint64_t end;
+    uint64_t lost;
+    int n;
+    char *msg[MAX_BATCH];
+    uint32_t len[MAX_BATCH];
+}run_t;
+
+//thread-local so -D worker threads can each point it at the shard they are working on
+_Thread_local queue_t *q_t;
+size_t shm_size;
+bool huge_pages = false;
+
+//-J: the segment is this file on disk instead of POSIX shm, flushed by group commit every
+//-G messages or -I microseconds, whichever comes first. Consumers only see committed records,
+//so the group size also bounds how far they trail the producer
+const char *journal_path = NULL;
+int group_messages = 256;
+int group_us = 1000;
+uint64_t journal_pending;
+uint64_t journal_last_sync;
+unsigned long journal_syncs;
+
+//names of every object belonging to one channel
+typedef struct{
+    char topic[CHANNEL_NAME];
+    char socket[64];
+    char shm[NAME_MAX];
+    char huge[PATH_MAX];
+    char full[NAME_MAX];
+    char empty[NAME_MAX];
+    char mutex[NAME_MAX];
+}channel_names_t;
+
+//one directory entry per channel that a producer has created
+typedef struct{
+    bool used;
+    bool huge;
+    int mode;
+    int q_size;
+    uint64_t ring_bytes;
+    char topic[CHANNEL_NAME];
+}channel_t;
+
+typedef struct{
+    channel_t channels[MAX_CHANNELS];
+}directory_t;
+
+//the channel selected with -t; without -t it is the unnamed channel using the original names
+channel_names_t names;
+
+//per-process wait policy and the counters reported at exit
+typedef struct{
+    unsigned long waits;
+    unsigned long spins;
+    unsigned long yields;
+    unsigned long parks;
+}wait_stats_t;
+
+int wait_policy = WAIT_PARK;
+_Thread_local wait_stats_t wait_stats;
+const char *wait_policy_names[] = {"spin", "yield", "park", "block"};
+
+//-O back-pressure policy; producers set it when creating the segment, consumers follow the
+//segment's. The counters are this process's share of the segment's drop and loss stats
+typedef struct{
+    unsigned long dropped;
+    unsigned long overwritten;
+    unsigned long gaps;
+    unsigned long lost;
+}loss_stats_t;
+
+int overflow_policy = POLICY_BLOCK;
+_Thread_local loss_stats_t loss_stats;
+const char *overflow_policy_names[] = {"block", "drop", "overwrite"};
+
+//messages reserved and committed (or drained and released) per synchronisation, set with -b
+int batch_size = 1;
+//-k: keep one connection per producer and stream length-prefixed frames over it
+bool stream_mode = false;
+//-F: pass each payload as a sealed memfd over the producer's connection
+bool fd_mode = false;
+//-l: listen backlog for the socket consumers
+int listen_backlog = 5;
+//-i: producers send the records of this file ("-" for stdin) instead of -m; -R makes them
+//length-prefixed (a native uint32 then the payload) rather than newline-delimited
+const char *input_path = NULL;
+bool length_prefixed = false;
+//-o: consumers write every record to stdout, framed the same way as -i input
+bool output_mode = false;
+//fill n with the object names for topic; the empty topic keeps the original fixed names
+static void channel_names(const char *topic, channel_names_t *n){
+    snprintf(n->topic, sizeof(n->topic), "%s", topic);
+    if (topic[0] == '\0') {
+        snprintf(n->socket, sizeof(n->socket), "%s", SOCKET_NAME);
+        snprintf(n->shm, sizeof(n->shm), "%s", SHM_NAME);
+        snprintf(n->huge, sizeof(n->huge), "%s", HUGE_SHM_PATH);
+        snprintf(n->full, sizeof(n->full), "%s", SEM_FULL);
+        snprintf(n->empty, sizeof(n->empty), "%s", SEM_EMPTY);
+        snprintf(n->mutex, sizeof(n->mutex), "%s", SEM_MUTEX);
+        return;
+    }
+    snprintf(n->socket, sizeof(n->socket), "/tmp/pc_%s.sock", topic);
+    snprintf(n->shm, sizeof(n->shm), "%s_%s", SHM_NAME, topic);
+    snprintf(n->huge, sizeof(n->huge), "%s_%s", HUGE_SHM_PATH, topic);
+    snprintf(n->full, sizeof(n->full), "%s_%s", SEM_FULL, topic);
+    snprintf(n->empty, sizeof(n->empty), "%s_%s", SEM_EMPTY, topic);
+    snprintf(n->mutex, sizeof(n->mutex), "%s_%s", SEM_MUTEX, topic);
+}
+
+//-P: producer connections the -E and -U consumers wait to see close before their idle
+//shutdown; with -k that is one per producer, without it one per message, so without -k it is
+//required. A shared-memory consumer likewise waits for -P producers to finish before it treats
+//done as final
+int expected_producers = 0;
+
+//-j benchmark mode: producers stamp the first STAMP_LEN bytes of every message with their
+//send time in hex and the consumer prints a JSON throughput/latency summary. Latencies go
+//into a log-linear (HDR) histogram: HIST_SUB linear buckets below HIST_SUB ns, then
+//HIST_SUB/2 buckets per power of two, so every value is kept to within 1.6%
+#define STAMP_LEN 16
+#define HIST_SUB_BITS 7
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_HALF (HIST_SUB / 2)
+#define HIST_SIZE (HIST_SUB + (64 - HIST_SUB_BITS) * HIST_HALF)
+typedef struct{
+    uint64_t counts[HIST_SIZE];
+    uint64_t n;
+    uint64_t max;
+    uint64_t bytes;
+    uint64_t first_sent;
+    uint64_t last_recv;
+}bench_t;
+
+//-Y: clock for the stamps, CLOCK_MONOTONIC nanoseconds or the TSC; both ends must agree
+#define CLOCK_MONO 0
+#define CLOCK_TSC 1
+const char *stamp_clock_names[] = {"mono", "tsc"};
+
+bool bench_mode = false;
+int stamp_clock = CLOCK_MONO;
+//TSC ticks to nanoseconds, measured against CLOCK_MONOTONIC by calibrate_tsc
+double ns_per_tick = 1.0;
+_Thread_local bench_t bench;
+//what the consumer is measuring, for the "transport" and "mode" fields of the report
+const char *bench_transport = "";
+const char *bench_kind = "";
+//SIGUSR1 asks the consumer for the percentiles so far. The flag is polled wherever the consumer
+//waits, and parked waits time out every REPORT_CHECK_MS so a quiet queue still answers
+volatile sig_atomic_t report_requested = 0;
+#define REPORT_CHECK_MS 100
+
+static uint64_t now_ns(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline uint64_t read_tsc(){
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    return now_ns();
+#endif
+}
+
+static uint64_t stamp_now(){
+    return stamp_clock == CLOCK_TSC ? read_tsc() : now_ns();
+}
+
+//time the TSC against CLOCK_MONOTONIC for 20 ms so TSC stamps can be reported in ns
+static void calibrate_tsc(){
+    uint64_t t0 = now_ns(), c0 = read_tsc();
+    struct timespec pause = { 0, 20000000L };
+    nanosleep(&pause, NULL);
+    uint64_t t1 = now_ns(), c1 = read_tsc();
+    ns_per_tick = (double)(t1 - t0) / (double)(c1 - c0);
+}
+
+//overwrite the start of an outgoing message with the current time
+static void stamp_message(char *dst){
+    static const char hex[] = "0123456789abcdef";
+    uint64_t t = stamp_now();
+    for (int i = STAMP_LEN - 1; i >= 0; i--) {
+        dst[i] = hex[t & 0xf];
+        t >>= 4;
+    }
+}
+
+//histogram bucket holding v
+static int hist_index(uint64_t v){
+    if (v < HIST_SUB) {
+        return v;
+    }
+    int shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS + 1;
+    return HIST_SUB + (shift - 1) * HIST_HALF + (int)((v >> shift) - HIST_HALF);
+}
+
+//largest value that lands in bucket i
+static uint64_t hist_value(int i){
+    if (i < HIST_SUB) {
+        return i;
+    }
+    int shift = (i - HIST_SUB) / HIST_HALF + 1;
+    uint64_t top = (i - HIST_SUB) % HIST_HALF + HIST_HALF;
+    return ((top + 1) << shift) - 1;
+}
+
+void bench_report();
+
+//print the report SIGUSR1 asked for, if it did
+static void bench_poll_report(){
+    if (report_requested) {
+        report_requested = 0;
+        bench_report();
+    }
+}
+
+//account one received message; its latency is now minus the stamp the producer wrote
+static void bench_record(const char *msg, size_t len){
+    if (!bench_mode || len < STAMP_LEN) {
+        return;
+    }
+    uint64_t sent = 0;
+    for (int i = 0; i < STAMP_LEN; i++) {
+        char ch = msg[i];
+        int v = (ch >= '0' && ch <= '9') ? ch - '0' : (ch >= 'a' && ch <= 'f') ? ch - 'a' + 10 : -1;
+        if (v < 0) {
+            return;
+        }
+        sent = (sent << 4) | v;
+    }
+    uint64_t now = now_ns();
+    uint64_t lat;
+    if (stamp_clock == CLOCK_TSC) {
+        uint64_t ticks = read_tsc();
+        lat = (ticks > sent) ? (uint64_t)((ticks - sent) * ns_per_tick) : 0;
+    } else {
+        lat = (now > sent) ? now - sent : 0;
+    }
+    bench.counts[hist_index(lat)]++;
+    bench.n++;
+    if (lat > bench.max) bench.max = lat;
+    bench.bytes += len;
+    if (bench.first_sent == 0 || now - lat < bench.first_sent) {
+        bench.first_sent = now - lat;
+    }
+    bench.last_recv = now;
+    bench_poll_report();
+}
+
+static void request_report(int sig){
+    (void)sig;
+    report_requested = 1;
+}
+
+//fold another thread's samples into this thread's bench before reporting
+static void bench_merge(const bench_t *b){
+    for (int i = 0; i < HIST_SIZE; i++) {
+        bench.counts[i] += b->counts[i];
+    }
+    bench.n += b->n;
+    if (b->max > bench.max) bench.max = b->max;
+    bench.bytes += b->bytes;
+    if (b->n > 0 && (bench.first_sent == 0 || b->first_sent < bench.first_sent)) {
+        bench.first_sent = b->first_sent;
+    }
+    if (b->last_recv > bench.last_recv) {
+        bench.last_recv = b->last_recv;
+    }
+}
+
+//value at or below which a fraction p of the recorded latencies fall
+static uint64_t bench_percentile(double p){
+    uint64_t rank = (uint64_t)(p * bench.n + 0.999999);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_SIZE; i++) {
+        seen += bench.counts[i];
+        if (seen >= rank) {
+            uint64_t v = hist_value(i);
+            return v < bench.max ? v : bench.max;
+        }
+    }
+    return bench.max;
+}
+
+//print one JSON object describing the run so a driver can collect results across builds
+void bench_report(){
+    const char *transport = bench_transport, *mode = bench_kind;
+    if (bench.n == 0) {
+        printf("{\"transport\":\"%s\",\"mode\":\"%s\",\"messages\":0}\n", transport, mode);
+        fflush(stdout);
+        return;
+    }
+    double seconds = (bench.last_recv - bench.first_sent) / 1e9;
+    if (seconds <= 0) seconds = 1e-9;
+    printf("{\"transport\":\"%s\",\"mode\":\"%s\",\"clock\":\"%s\",\"messages\":%llu,\"bytes\":%llu,"
+           "\"seconds\":%.6f,\"msgs_per_sec\":%.0f,\"bytes_per_sec\":%.0f,"
+           "\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"p9999_ns\":%llu,\"max_ns\":%llu}\n",
+           transport, mode, stamp_clock_names[stamp_clock], (unsigned long long)bench.n,
+           (unsigned long long)bench.bytes, seconds, bench.n / seconds, bench.bytes / seconds,
+           (unsigned long long)bench_percentile(0.50), (unsigned long long)bench_percentile(0.90),
+           (unsigned long long)bench_percentile(0.99), (unsigned long long)bench_percentile(0.999),
+           (unsigned long long)bench_percentile(0.9999), (unsigned long long)bench.max);
+    fflush(stdout);
+}
 
 
 //producer function for unix sockets
@@ -49,7 +522,7 @@ void producer_socket(bool e, const char *m, int q){
         int producer_file;
         memset(&addr, 0, sizeof(struct sockaddr_un));
         addr.sun_family = AF_UNIX;
-        strncpy(addr.sun_path, SOCKET_NAME, sizeof(addr.sun_path) - 1);
+        strncpy(addr.sun_path, names.socket, sizeof(addr.sun_path) - 1);
         char buffer[BUFFER_SIZE];
         //loop for connection attempt if producer is ran first to retry connection until consumer
         while (1) {
@@ -72,8 +545,13 @@ void producer_socket(bool e, const char *m, int q){
             }
         }
 
-        //send message
-        if(write(producer_file, m, strlen(m)) < 0){
+        //send message, stamped with its send time in -j mode
+        size_t len = strnlen(m, BUFFER_SIZE - 1);
+        memcpy(buffer, m, len);
+        if(bench_mode){
+            stamp_message(buffer);
+        }
+        if(write(producer_file, buffer, len) < 0){
             perror("Write failed");
             close(producer_file);
             exit(EXIT_FAILURE);
@@ -86,270 +564,3036 @@ void producer_socket(bool e, const char *m, int q){
   }
 }
 
-//consumer function for unix sockets
-void consumer_socket(bool e, int q){
-    int producer_file, con_fd;
+//connect to the consumer, retrying once a second until it is listening
+static int connect_consumer(){
     struct sockaddr_un addr;
-    char buffer[BUFFER_SIZE];
-    int messages_received = 0;
-    struct timeval timeout;
-    fd_set readfds;
-    
-    // socket creation
-    if((producer_file = socket(AF_UNIX, SOCK_STREAM, 0)) < 0){
-        perror("Socket creation failed");
-        exit(EXIT_FAILURE);
-    }
-    // set socket address
     memset(&addr, 0, sizeof(struct sockaddr_un));
     addr.sun_family = AF_UNIX;
-
-    strncpy(addr.sun_path, SOCKET_NAME, sizeof(addr.sun_path) - 1);
-    
-    unlink(SOCKET_NAME);
-
-    if(bind(producer_file, (struct sockaddr *)&addr, sizeof(struct sockaddr_un))){
-        perror("Bind failed");
+    strncpy(addr.sun_path, names.socket, sizeof(addr.sun_path) - 1);
+    while (1) {
+        int producer_file = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (producer_file < 0) {
+            perror("Producer: socket failed");
+            exit(EXIT_FAILURE);
+        }
+        if(connect(producer_file, (const struct sockaddr *) &addr, sizeof(struct sockaddr_un)) == 0){
+            return producer_file;
+        }
+        perror("Connect failed, waiting for consumer");
+        sleep(1);
         close(producer_file);
-        exit(EXIT_FAILURE);
     }
+}
 
-    if(listen(producer_file, 5) == -1){
-        perror("Listen failed");
-        close(producer_file);
-        exit(EXIT_FAILURE);
-    }
-    
-    printf("Consumer started. Waiting for messages...\n");
-    
-    // Run until timeout indicates no more producers
-    int consecutive_timeouts = 0;
-    while(1){
-        // Set up for select call
-        FD_ZERO(&readfds);
-        FD_SET(producer_file, &readfds);
-        
-        // Set timeout to 3 seconds
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
-        
-        int activity = select(producer_file + 1, &readfds, NULL, NULL, &timeout);
-        
-        if (activity < 0) {
-            perror("Select error");
-            break;
-        }
-        else if (activity == 0) {
-            // Timeout occurred, no connection request
-            consecutive_timeouts++;
-            
-            // If we've waited for multiple timeouts and already received some messages,
-            // assume all producers are done
-            if (consecutive_timeouts >= 2 && messages_received > 0) {
-                printf("No new connections for %d seconds. Assuming all producers finished.\n", 
-                       consecutive_timeouts * 3);
-                break;
-            }
-            continue;
-        }
-        
-        // Reset timeout counter if we get activity
-        consecutive_timeouts = 0;
-        
-        // Now it's safe to accept
-        con_fd = accept(producer_file, NULL, NULL);
-        if(con_fd == -1){
-            perror("Accept failed");
-            close(producer_file);
-            exit(EXIT_FAILURE);
+//write every byte described by iov, resuming after partial writes
+static int writev_all(int fd, struct iovec *iov, int iovcnt){
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
         }
-        
-        memset(buffer, 0, BUFFER_SIZE);
-    
-        if(read(con_fd, buffer, BUFFER_SIZE - 1) > 0){
-            messages_received++;
-            if(e)
-            {
-                printf("Consumer received: %s (message %d)\n", buffer, messages_received);
-            }
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
         }
-        else{
-            perror("Read failed");
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
         }
-        
-        close(con_fd);
     }
-
-    printf("All messages consumed (%d total). Exiting.\n", messages_received);
-    close(producer_file);
-    unlink(SOCKET_NAME);
+    return 0;
 }
 
+//-i record source: a regular file is mapped whole, anything else is read IN_BUFFER at a time
+//(more for a longer record). Records are handed out in place, so a pointer from src_next
+//stays valid only until the next src_refill
+typedef struct{
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t start;
+    size_t fill;
+    bool mapped;
+    bool eof;
+    uint64_t records;
+    uint64_t bytes;
+}src_t;
 
-//function to create section of shared memory
-void create_sharedmem(int q){
-    int shm_fd = shm_open(SHM_NAME, O_CREAT| O_RDWR, 0666);
-    if (shm_fd == -1) {
-        perror("shm_open failed");
+static void src_open(src_t *s, const char *path){
+    memset(s, 0, sizeof(*s));
+    s->fd = (strcmp(path, "-") == 0) ? STDIN_FILENO : open(path, O_RDONLY);
+    if (s->fd == -1) {
+        perror("Input: open failed");
         exit(EXIT_FAILURE);
     }
-    
-    struct stat shm_stat;
-    if (fstat(shm_fd, &shm_stat) == -1) {
-        perror("fstat failed");
+    struct stat st;
+    if (fstat(s->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        s->buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, s->fd, 0);
+        if (s->buf != MAP_FAILED) {
+            madvise(s->buf, st.st_size, MADV_SEQUENTIAL);
+            s->cap = s->fill = st.st_size;
+            s->mapped = true;
+            s->eof = true;
+            return;
+        }
+    }
+    s->cap = IN_BUFFER;
+    s->buf = malloc(s->cap);
+    if (s->buf == NULL) {
+        perror("malloc failed");
         exit(EXIT_FAILURE);
     }
-    
-    int existing_q = 0;
-    size_t needed_size = sizeof(queue_t) + (q * BUFFER_SIZE);
-    size_t existing_size = shm_stat.st_size;
-    
-    // If shared memory already exists, determine its queue size
-    if (existing_size > sizeof(queue_t)) {
-        queue_t *temp = mmap(NULL, sizeof(queue_t), PROT_READ, MAP_SHARED, shm_fd, 0);
-        if (temp == MAP_FAILED) {
-            perror("mmap failed during size check");
-            exit(EXIT_FAILURE);
+}
+
+//next complete record already buffered; at end of input a final line without its newline
+//still counts, a truncated length-prefixed record is an error
+static bool src_next(src_t *s, const char **p, uint32_t *len){
+    size_t avail = s->fill - s->start;
+    const char *at = s->buf + s->start;
+    size_t used;
+    if (length_prefixed) {
+        if (avail < sizeof(uint32_t)) {
+            if (s->eof && avail > 0) {
+                fprintf(stderr, "Input: truncated record length at end of input\n");
+                exit(EXIT_FAILURE);
+            }
+            return false;
         }
-        existing_q = temp->q_size;
-        munmap(temp, sizeof(queue_t));
-        
-        // Update needed size to use the larger of the two queue sizes
-        int max_q = (existing_q > q) ? existing_q : q;
-        needed_size = sizeof(queue_t) + (max_q * BUFFER_SIZE);
+        memcpy(len, at, sizeof(*len));
+        if (avail - sizeof(uint32_t) < *len) {
+            if (s->eof) {
+                fprintf(stderr, "Input: truncated %u byte record at end of input\n", *len);
+                exit(EXIT_FAILURE);
+            }
+            return false;
+        }
+        *p = at + sizeof(uint32_t);
+        used = sizeof(uint32_t) + *len;
+    } else {
+        const char *nl = memchr(at, '\n', avail);
+        if (nl == NULL && !(s->eof && avail > 0)) {
+            return false;
+        }
+        *p = at;
+        *len = (nl != NULL) ? (uint32_t)(nl - at) : (uint32_t)avail;
+        used = (nl != NULL) ? *len + 1 : *len;
     }
-    
-    // Resize shared memory to accommodate the larger queue if needed
-    if (needed_size > existing_size) {
-        if (ftruncate(shm_fd, needed_size) == -1) {
-            perror("ftruncate failed");
+    s->start += used;
+    s->records++;
+    s->bytes += *len;
+    return true;
+}
+
+//keep the unparsed tail and read more behind it; false once the input is exhausted
+static bool src_refill(src_t *s){
+    if (s->eof) {
+        return false;
+    }
+    memmove(s->buf, s->buf + s->start, s->fill - s->start);
+    s->fill -= s->start;
+    s->start = 0;
+    if (s->fill == s->cap) {
+        // a single record longer than the buffer
+        s->cap *= 2;
+        s->buf = realloc(s->buf, s->cap);
+        if (s->buf == NULL) {
+            perror("realloc failed");
             exit(EXIT_FAILURE);
         }
     }
-
-    // Map the shared memory
-    q_t = mmap(NULL, needed_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
-    if (q_t == MAP_FAILED) {
-        perror("mmap failed");
+    ssize_t n;
+    do {
+        n = read(s->fd, s->buf + s->fill, s->cap - s->fill);
+    } while (n < 0 && errno == EINTR);
+    if (n < 0) {
+        perror("Input: read failed");
         exit(EXIT_FAILURE);
     }
-    
-    sem_wait(mutex);
-    if(q_t->running == 0){
-        q_t->head = 0;
-        q_t->tail = 0;
-        q_t->q_size = q;
-        q_t->count = 0;
-        q_t->running = 1;
-        q_t->done = 0;
-        for (int i = 0; i < q; i++) 
-        {
-            memset(&q_t->messages[i * BUFFER_SIZE], 0, BUFFER_SIZE);
-        }
+    if (n == 0) {
+        s->eof = true;
     }
-    else if (q > q_t->q_size) {
-        // Expand the queue size if needed
-        printf("Expanding queue from %d to %d\n", q_t->q_size, q);
-        
-        // Initialize new message slots
-        for (int i = q_t->q_size; i < q; i++) 
-        {
-            memset(&q_t->messages[i * BUFFER_SIZE], 0, BUFFER_SIZE);
-        }
-        
-        q_t->q_size = q;
+    s->fill += n;
+    return true;
+}
+
+static void src_close(src_t *s, uint64_t start_ns){
+    double secs = (now_ns() - start_ns) / 1e9;
+    fprintf(stderr, "Input: %llu records, %llu bytes in %.3f s (%.3f GB/s)\n",
+            (unsigned long long)s->records, (unsigned long long)s->bytes, secs,
+            secs > 0 ? s->bytes / secs / 1e9 : 0.0);
+    if (s->mapped) {
+        munmap(s->buf, s->cap);
+    } else {
+        free(s->buf);
+    }
+    if (s->fd != STDIN_FILENO) {
+        close(s->fd);
     }
-    
-    q_t->count++;
-    sem_post(mutex);
 }
 
-//function for producer in shared memory, iterates through queue size and produces messages 
-void producer_shared(const char *m, int q, bool e){
-    for(int i = 0; i < q; i++){
-        sem_wait(empty);
-        sem_wait(mutex);
+//-o record sink: iovecs pointing at the records where they lie (ring slots or a receive
+//buffer), written with one writev per OUT_IOV vectors. Callers flush before giving that
+//memory back, so nothing pending can be overwritten
+typedef struct{
+    int fd;
+    struct iovec iov[OUT_IOV];
+    uint32_t lens[OUT_IOV / 2];
+    int n;
+    uint64_t records;
+    uint64_t bytes;
+    uint64_t first_ns;
+}out_t;
 
-        strncpy(&q_t->messages[q_t->head * BUFFER_SIZE], m, BUFFER_SIZE - 1);
-        q_t->messages[q_t->head * BUFFER_SIZE + BUFFER_SIZE - 1] = '\0';
-        q_t->head = (q_t->head +1) % q_t->q_size;
-        if (e) 
-        {
-            printf("Message from Producer: %s\n", m);
-        }
+out_t out = { .fd = STDOUT_FILENO };
+
+static void out_flush(){
+    if (out.n == 0) {
+        return;
+    }
+    if (writev_all(out.fd, out.iov, out.n) < 0) {
+        perror("Output: writev failed");
+        exit(EXIT_FAILURE);
+    }
+    out.n = 0;
+}
+
+static void out_record(const char *p, uint32_t len){
+    if (out.n + 2 > OUT_IOV) {
+        out_flush();
+    }
+    if (out.records++ == 0) {
+        out.first_ns = now_ns();
+    }
+    out.bytes += len;
+    if (length_prefixed) {
+        uint32_t *hdr = &out.lens[out.n / 2];
+        *hdr = len;
+        out.iov[out.n++] = (struct iovec){ hdr, sizeof(*hdr) };
+        out.iov[out.n++] = (struct iovec){ (void *)p, len };
+    } else {
+        out.iov[out.n++] = (struct iovec){ (void *)p, len };
+        out.iov[out.n++] = (struct iovec){ "\n", 1 };
+    }
+}
+
+static void out_close(){
+    out_flush();
+    double secs = out.records ? (now_ns() - out.first_ns) / 1e9 : 0;
+    fprintf(stderr, "Output: %llu records, %llu bytes in %.3f s (%.3f GB/s)\n",
+            (unsigned long long)out.records, (unsigned long long)out.bytes, secs,
+            secs > 0 ? out.bytes / secs / 1e9 : 0.0);
+}
+
+//-i over a streaming socket: records go out as frames whose payload iovecs point straight
+//into the input, a batch per writev, flushed before the input buffer is refilled
+void producer_socket_records(bool e){
+    int frames = (batch_size > 1) ? batch_size : STREAM_FRAMES;
+    if (frames > STREAM_IOV / 2) frames = STREAM_IOV / 2;
+    struct iovec iov[STREAM_IOV];
+    uint32_t lens[STREAM_IOV / 2];
+    src_t src;
+    src_open(&src, input_path);
+    int producer_file = connect_consumer();
+    uint64_t start = now_ns();
+
+    while (1) {
+        int n = 0;
+        const char *p;
+        while (n < frames && src_next(&src, &p, &lens[n])) {
+            if (lens[n] > STREAM_BUFFER - sizeof(uint32_t)) {
+                fprintf(stderr, "Error: %u byte record exceeds the %d byte stream frame limit\n",
+                        lens[n], (int)(STREAM_BUFFER - sizeof(uint32_t)));
+                exit(EXIT_FAILURE);
+            }
+            iov[2 * n].iov_base = &lens[n];
+            iov[2 * n].iov_len = sizeof(uint32_t);
+            iov[2 * n + 1].iov_base = (void *)p;
+            iov[2 * n + 1].iov_len = lens[n];
+            if (e) {
+                printf("Message from Producer: %.*s\n", (int)lens[n], p);
+            }
+            n++;
+        }
+        if (n > 0 && writev_all(producer_file, iov, 2 * n) < 0) {
+            perror("Write failed");
+            close(producer_file);
+            exit(EXIT_FAILURE);
+        }
+        if (n < frames && !src_refill(&src)) {
+            break;
+        }
+    }
+    close(producer_file);
+    src_close(&src, start);
+}
+
+//streaming producer for unix sockets: one connection for all q messages, each sent as a
+//length-prefixed frame and many frames coalesced into one writev
+void producer_socket_stream(bool e, const char *m, int q){
+    uint32_t len = strlen(m);
+    if (len > STREAM_BUFFER - sizeof(uint32_t)) {
+        fprintf(stderr, "Error: %u byte message exceeds the %d byte stream frame limit\n",
+                len, (int)(STREAM_BUFFER - sizeof(uint32_t)));
+        exit(EXIT_FAILURE);
+    }
+    int frames = (batch_size > 1) ? batch_size : STREAM_FRAMES;
+    if (frames > STREAM_IOV / 2) frames = STREAM_IOV / 2;
+    struct iovec iov[STREAM_IOV];
+    // -j frames each carry their own send time, so they need their own payload copies
+    char *stamped = NULL;
+    if (bench_mode) {
+        stamped = malloc((size_t)frames * len);
+        if (stamped == NULL) {
+            perror("malloc failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    int producer_file = connect_consumer();
+
+    for(int i = 0; i < q; ){
+        int n = (q - i < frames) ? q - i : frames;
+        // every frame carries the same payload, so they can share one header
+        for (int k = 0; k < n; k++) {
+            iov[2 * k].iov_base = &len;
+            iov[2 * k].iov_len = sizeof(len);
+            iov[2 * k + 1].iov_base = (void *)m;
+            iov[2 * k + 1].iov_len = len;
+            if (stamped != NULL) {
+                memcpy(stamped + (size_t)k * len, m, len);
+                stamp_message(stamped + (size_t)k * len);
+                iov[2 * k + 1].iov_base = stamped + (size_t)k * len;
+            }
+        }
+        if(writev_all(producer_file, iov, 2 * n) < 0){
+            perror("Write failed");
+            close(producer_file);
+            exit(EXIT_FAILURE);
+        }
+        for (int k = 0; k < n && e; k++) {
+            printf("Message from Producer: %s\n", m);
+        }
+        i += n;
+    }
+    free(stamped);
+    close(producer_file);
+}
+
+//hand out every complete length-prefixed frame in buf, returning the bytes they used so the
+//caller can keep a trailing partial frame, or -1 for a frame too large to ever complete
+static ssize_t parse_frames(const char *buf, size_t fill, bool e, int *messages_received){
+    size_t off = 0;
+    while (fill - off >= sizeof(uint32_t)) {
+        uint32_t len;
+        memcpy(&len, buf + off, sizeof(len));
+        if (len > STREAM_BUFFER - sizeof(len)) {
+            fprintf(stderr, "Consumer: %u byte frame exceeds the stream buffer\n", len);
+            return -1;
+        }
+        if (fill - off < sizeof(len) + len) break;
+        (*messages_received)++;
+        bench_record(buf + off + sizeof(len), len);
+        if (output_mode) {
+            out_record(buf + off + sizeof(len), len);
+        }
+        if(e)
+        {
+            printf("Consumer received: %.*s (message %d)\n", (int)len,
+                   buf + off + sizeof(len), *messages_received);
+        }
+        off += sizeof(len) + len;
+    }
+    // the caller reuses buf once we return
+    if (output_mode) {
+        out_flush();
+    }
+    return off;
+}
+
+//read length-prefixed frames from one streaming producer until it closes the connection,
+//returning the updated count of messages received
+static int read_frames(int con_fd, bool e, int messages_received){
+    static char stream[STREAM_BUFFER];
+    size_t fill = 0;
+    while (1) {
+        ssize_t n = read(con_fd, stream + fill, sizeof(stream) - fill);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("Read failed");
+            break;
+        }
+        if (n == 0) {
+            if (fill > 0) {
+                fprintf(stderr, "Consumer: connection closed inside a frame\n");
+            }
+            break;
+        }
+        fill += n;
+
+        // keep the partial frame at the end for the next read
+        ssize_t used = parse_frames(stream, fill, e, &messages_received);
+        if (used < 0) {
+            break;
+        }
+        memmove(stream, stream + used, fill - used);
+        fill -= used;
+    }
+    return messages_received;
+}
+
+//descriptor-passing producer: each of the q payloads is written into its own memfd, sealed
+//against further change and sent with SCM_RIGHTS, so only the 8 byte length crosses the socket
+void producer_socket_fd(bool e, const char *m, int q){
+    uint64_t len = strlen(m);
+    if (len == 0) {
+        fprintf(stderr, "Error: -F needs a non-empty payload\n");
+        exit(EXIT_FAILURE);
+    }
+    int producer_file = connect_consumer();
+
+    for(int i = 0; i < q; i++){
+        int memfd = memfd_create("pc_payload", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (memfd == -1) {
+            perror("memfd_create failed");
+            exit(EXIT_FAILURE);
+        }
+        if (ftruncate(memfd, len) == -1) {
+            perror("ftruncate failed");
+            exit(EXIT_FAILURE);
+        }
+        char *payload = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, memfd, 0);
+        if (payload == MAP_FAILED) {
+            perror("mmap failed");
+            exit(EXIT_FAILURE);
+        }
+        memcpy(payload, m, len);
+        if (bench_mode) {
+            stamp_message(payload);
+        }
+        // F_SEAL_WRITE is refused while a writable mapping exists
+        munmap(payload, len);
+        if (fcntl(memfd, F_ADD_SEALS, PAYLOAD_SEALS) == -1) {
+            perror("F_ADD_SEALS failed");
+            exit(EXIT_FAILURE);
+        }
+
+        union{
+            char buf[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        }control;
+        struct iovec iov = { .iov_base = &len, .iov_len = sizeof(len) };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                              .msg_control = control.buf, .msg_controllen = sizeof(control.buf) };
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &memfd, sizeof(int));
+        ssize_t n;
+        while ((n = sendmsg(producer_file, &msg, 0)) < 0 && errno == EINTR);
+        if (n != sizeof(len)) {
+            perror("sendmsg failed");
+            close(producer_file);
+            exit(EXIT_FAILURE);
+        }
+        close(memfd);
+        if(e){
+            printf("Producer sent %llu byte payload by descriptor\n", (unsigned long long)len);
+        }
+    }
+    close(producer_file);
+}
+
+//receive memfd payloads from one -F producer until it closes the connection, mapping each
+//read-only; returns the updated count of messages received
+static int read_payloads(int con_fd, bool e, int messages_received){
+    while (1) {
+        uint64_t len;
+        union{
+            char buf[CMSG_SPACE(sizeof(int))];
+            struct cmsghdr align;
+        }control;
+        struct iovec iov = { .iov_base = &len, .iov_len = sizeof(len) };
+        struct msghdr msg = { .msg_iov = &iov, .msg_iovlen = 1,
+                              .msg_control = control.buf, .msg_controllen = sizeof(control.buf) };
+        ssize_t n = recvmsg(con_fd, &msg, MSG_CMSG_CLOEXEC);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            perror("recvmsg failed");
+            break;
+        }
+        if (n == 0) {
+            break;
+        }
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        if (n != sizeof(len) || cmsg == NULL || cmsg->cmsg_type != SCM_RIGHTS ||
+            (msg.msg_flags & MSG_CTRUNC)) {
+            fprintf(stderr, "Consumer: malformed descriptor message\n");
+            break;
+        }
+        int memfd;
+        memcpy(&memfd, CMSG_DATA(cmsg), sizeof(int));
+
+        // without these seals the producer could truncate the file under our mapping
+        struct stat st;
+        int seals = fcntl(memfd, F_GET_SEALS);
+        if (seals == -1 || (seals & (F_SEAL_SHRINK | F_SEAL_WRITE)) != (F_SEAL_SHRINK | F_SEAL_WRITE) ||
+            fstat(memfd, &st) == -1 || (uint64_t)st.st_size != len) {
+            fprintf(stderr, "Consumer: payload descriptor is not sealed or has the wrong size\n");
+            close(memfd);
+            break;
+        }
+        char *payload = mmap(NULL, len, PROT_READ, MAP_SHARED, memfd, 0);
+        close(memfd);
+        if (payload == MAP_FAILED) {
+            perror("mmap failed");
+            break;
+        }
+        messages_received++;
+        bench_record(payload, len);
+        if(e)
+        {
+            printf("Consumer received %llu byte payload: %.*s (message %d)\n", (unsigned long long)len,
+                   (int)(len < PAYLOAD_PREVIEW ? len : PAYLOAD_PREVIEW), payload, messages_received);
+        }
+        munmap(payload, len);
+    }
+    return messages_received;
+}
+
+//create the consumer's listening socket at the channel's socket path with the -l backlog
+static int listen_consumer(){
+    int producer_file;
+    struct sockaddr_un addr;
+
+    // socket creation
+    if((producer_file = socket(AF_UNIX, SOCK_STREAM, 0)) < 0){
+        perror("Socket creation failed");
+        exit(EXIT_FAILURE);
+    }
+    // set socket address
+    memset(&addr, 0, sizeof(struct sockaddr_un));
+    addr.sun_family = AF_UNIX;
+
+    strncpy(addr.sun_path, names.socket, sizeof(addr.sun_path) - 1);
+    
+    unlink(names.socket);
+
+    if(bind(producer_file, (struct sockaddr *)&addr, sizeof(struct sockaddr_un))){
+        perror("Bind failed");
+        close(producer_file);
+        exit(EXIT_FAILURE);
+    }
+
+    if(listen(producer_file, listen_backlog) == -1){
+        perror("Listen failed");
+        close(producer_file);
+        exit(EXIT_FAILURE);
+    }
+    return producer_file;
+}
+
+//consumer function for unix sockets
+void consumer_socket(bool e, int q){
+    int producer_file, con_fd;
+    char buffer[BUFFER_SIZE];
+    int messages_received = 0;
+    struct timeval timeout;
+    fd_set readfds;
+    
+    producer_file = listen_consumer();
+    
+    printf("Consumer started. Waiting for messages...\n");
+    fflush(stdout);
+    
+    // Run until timeout indicates no more producers
+    int consecutive_timeouts = 0;
+    while(1){
+        // Set up for select call
+        FD_ZERO(&readfds);
+        FD_SET(producer_file, &readfds);
+        
+        // Set timeout to 3 seconds
+        timeout.tv_sec = 1;
+        timeout.tv_usec = 0;
+        
+        int activity = select(producer_file + 1, &readfds, NULL, NULL, &timeout);
+        
+        if (activity < 0 && errno == EINTR) {
+            // SIGUSR1 wants a -j report
+            bench_poll_report();
+            continue;
+        }
+        if (activity < 0) {
+            perror("Select error");
+            break;
+        }
+        else if (activity == 0) {
+            // Timeout occurred, no connection request
+            consecutive_timeouts++;
+            
+            // If we've waited for multiple timeouts and already received some messages,
+            // assume all producers are done
+            if (consecutive_timeouts >= 2 && messages_received > 0) {
+                printf("No new connections for %d seconds. Assuming all producers finished.\n", 
+                       consecutive_timeouts * 3);
+                break;
+            }
+            continue;
+        }
+        
+        // Reset timeout counter if we get activity
+        consecutive_timeouts = 0;
+        
+        // Now it's safe to accept
+        con_fd = accept(producer_file, NULL, NULL);
+        if(con_fd == -1){
+            perror("Accept failed");
+            close(producer_file);
+            exit(EXIT_FAILURE);
+        }
+        
+        if(stream_mode){
+            messages_received = read_frames(con_fd, e, messages_received);
+            close(con_fd);
+            continue;
+        }
+        if(fd_mode){
+            messages_received = read_payloads(con_fd, e, messages_received);
+            close(con_fd);
+            continue;
+        }
+
+        memset(buffer, 0, BUFFER_SIZE);
+    
+        ssize_t n = read(con_fd, buffer, BUFFER_SIZE - 1);
+        if(n > 0){
+            messages_received++;
+            bench_record(buffer, n);
+            if(e)
+            {
+                printf("Consumer received: %s (message %d)\n", buffer, messages_received);
+            }
+        }
+        else{
+            perror("Read failed");
+        }
+        
+        close(con_fd);
+    }
+
+    printf("All messages consumed (%d total). Exiting.\n", messages_received);
+    close(producer_file);
+    unlink(names.socket);
+}
+
+
+//one producer connection held open by consumer_socket_epoll
+typedef struct{
+    int fd;
+    bool ready;
+    size_t fill;
+    char buf[STREAM_BUFFER];
+}conn_t;
+
+//accept every pending connection without blocking and register it edge-triggered; returns
+//false once the backlog is empty, true if it stopped because the connection table is full
+static bool accept_producers(int producer_file, int epoll_fd, conn_t **conns, int *open_conns){
+    while (*open_conns < MAX_CONNS) {
+        int con_fd = accept4(producer_file, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (con_fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("Accept failed");
+            }
+            return false;
+        }
+        int slot = 0;
+        while (conns[slot] != NULL) slot++;
+        conn_t *c = malloc(sizeof(conn_t));
+        if (c == NULL) {
+            perror("malloc failed");
+            exit(EXIT_FAILURE);
+        }
+        c->fd = con_fd;
+        c->fill = 0;
+        // data may have arrived before the edge-triggered registration
+        c->ready = true;
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP | EPOLLET, .data.ptr = c };
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, con_fd, &ev) == -1) {
+            perror("epoll_ctl failed");
+            exit(EXIT_FAILURE);
+        }
+        conns[slot] = c;
+        (*open_conns)++;
+    }
+    return true;
+}
+
+//give a ready connection one read's worth of service; returns false once it has closed
+static bool service_producer(conn_t *c, bool e, int *messages_received){
+    ssize_t n = read(c->fd, c->buf + c->fill, sizeof(c->buf) - c->fill);
+    if (n > 0) {
+        c->fill += n;
+        if (stream_mode) {
+            ssize_t used = parse_frames(c->buf, c->fill, e, messages_received);
+            if (used < 0) {
+                return false;
+            }
+            memmove(c->buf, c->buf + used, c->fill - used);
+            c->fill -= used;
+        } else if (c->fill > BUFFER_SIZE - 1) {
+            // one message per connection, truncated like the blocking consumer does
+            c->fill = BUFFER_SIZE - 1;
+        }
+        return true;
+    }
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        // drained until the next edge
+        c->ready = (errno == EINTR);
+        return true;
+    }
+    if (n < 0) {
+        perror("Read failed");
+    } else if (!stream_mode && c->fill > 0) {
+        (*messages_received)++;
+        bench_record(c->buf, c->fill);
+        if(e)
+        {
+            printf("Consumer received: %.*s (message %d)\n", (int)c->fill, c->buf, *messages_received);
+        }
+    } else if (c->fill > 0) {
+        fprintf(stderr, "Consumer: connection closed inside a frame\n");
+    }
+    return false;
+}
+
+//connection consumers' shutdown rule: no producer connection is open and at least -P have
+//closed, or with -k and no -P, the first producer to connect has gone
+static bool producers_gone(int open_conns, int disconnects){
+    return open_conns == 0 && disconnects > 0 && disconnects >= expected_producers;
+}
+
+//epoll consumer for unix sockets: keeps many producer connections open at once, reads them
+//non-blocking and round-robins one read per ready connection so no producer starves the rest.
+//It exits once every producer connection has closed and at least -P of them have been seen
+void consumer_socket_epoll(bool e){
+    static conn_t *conns[MAX_CONNS];
+    struct epoll_event events[64];
+    int messages_received = 0;
+    int open_conns = 0;
+    int disconnects = 0;
+    bool accept_pending = false;
+
+    int producer_file = listen_consumer();
+    fcntl(producer_file, F_SETFL, fcntl(producer_file, F_GETFL) | O_NONBLOCK);
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1) {
+        perror("epoll_create1 failed");
+        exit(EXIT_FAILURE);
+    }
+    struct epoll_event lev = { .events = EPOLLIN | EPOLLET, .data.ptr = NULL };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, producer_file, &lev) == -1) {
+        perror("epoll_ctl failed");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Consumer started. Waiting for messages...\n");
+    fflush(stdout);
+
+    while (1) {
+        bool any_ready = false;
+        for (int i = 0; i < MAX_CONNS; i++) {
+            if (conns[i] != NULL && conns[i]->ready) {
+                any_ready = true;
+                break;
+            }
+        }
+
+        // Block only when there is nothing left to drain; SIGUSR1 ends the wait with EINTR
+        bench_poll_report();
+        int n = epoll_wait(epoll_fd, events, 64, any_ready ? 0 : -1);
+        if (n < 0 && errno != EINTR) {
+            perror("epoll_wait failed");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == NULL) {
+                accept_pending = true;
+            } else {
+                ((conn_t *)events[i].data.ptr)->ready = true;
+            }
+        }
+        if (accept_pending) {
+            accept_pending = accept_producers(producer_file, epoll_fd, conns, &open_conns);
+        }
+
+        for (int i = 0; i < MAX_CONNS; i++) {
+            conn_t *c = conns[i];
+            if (c == NULL || !c->ready) continue;
+            if (!service_producer(c, e, &messages_received)) {
+                close(c->fd);
+                free(c);
+                conns[i] = NULL;
+                open_conns--;
+                disconnects++;
+                // a freed table slot lets a producer waiting in the backlog in
+                accept_pending = true;
+            }
+        }
+
+        // Idle shutdown: every producer seen so far has gone and nobody is queued to connect
+        if (producers_gone(open_conns, disconnects)) {
+            accept_pending = accept_producers(producer_file, epoll_fd, conns, &open_conns);
+            if (open_conns == 0) {
+                printf("All %d producers disconnected.\n", disconnects);
+                break;
+            }
+        }
+    }
+
+    printf("All messages consumed (%d total). Exiting.\n", messages_received);
+    close(epoll_fd);
+    close(producer_file);
+    unlink(names.socket);
+}
+
+//one io_uring instance and pointers into its mmapped submission and completion rings
+typedef struct{
+    int fd;
+    unsigned entries;
+    unsigned sq_local_tail;
+    _Atomic unsigned *sq_head;
+    _Atomic unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    _Atomic unsigned *cq_head;
+    _Atomic unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+}uring_t;
+
+static void uring_init(uring_t *u, unsigned entries){
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    u->fd = syscall(SYS_io_uring_setup, entries, &p);
+    if (u->fd < 0) {
+        perror("io_uring_setup failed");
+        exit(EXIT_FAILURE);
+    }
+    size_t sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    // with IORING_FEAT_SINGLE_MMAP both rings share the first mapping
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (cq_len > sq_len) sq_len = cq_len;
+    }
+    char *sq = mmap(NULL, sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    char *cq = sq;
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+        cq = mmap(NULL, cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    }
+    u->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (sq == MAP_FAILED || cq == MAP_FAILED || u->sqes == MAP_FAILED) {
+        perror("io_uring mmap failed");
+        exit(EXIT_FAILURE);
+    }
+    u->entries = p.sq_entries;
+    u->sq_head = (_Atomic unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (_Atomic unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->sq_local_tail = atomic_load(u->sq_tail);
+    u->cq_head = (_Atomic unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (_Atomic unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+}
+
+//publish the queued SQEs and, with wait, block until at least one completion is posted or
+//SIGUSR1 asks for a -j report
+static void uring_submit(uring_t *u, unsigned wait){
+    unsigned to_submit = u->sq_local_tail - atomic_load_explicit(u->sq_tail, memory_order_relaxed);
+    atomic_store_explicit(u->sq_tail, u->sq_local_tail, memory_order_release);
+    to_submit = u->sq_local_tail - atomic_load_explicit(u->sq_head, memory_order_acquire);
+    while (syscall(SYS_io_uring_enter, u->fd, to_submit, wait, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0) < 0) {
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            perror("io_uring_enter failed");
+            exit(EXIT_FAILURE);
+        }
+        if (errno != EINTR || report_requested) {
+            // completions must be reaped before more can be submitted
+            return;
+        }
+    }
+}
+
+//next free SQE, zeroed; submits what is queued first if the ring is full
+static struct io_uring_sqe *uring_sqe(uring_t *u){
+    while (u->sq_local_tail - atomic_load_explicit(u->sq_head, memory_order_acquire) >= u->entries) {
+        uring_submit(u, 0);
+    }
+    unsigned idx = u->sq_local_tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    u->sq_array[idx] = idx;
+    u->sq_local_tail++;
+    return sqe;
+}
+
+//write n frames of m into dst, returning the bytes used
+static size_t uring_pack(char *dst, const char *m, uint32_t len, int n, bool e){
+    size_t fill = 0;
+    for (int k = 0; k < n; k++) {
+        memcpy(dst + fill, &len, sizeof(len));
+        memcpy(dst + fill + sizeof(len), m, len);
+        if (bench_mode) {
+            stamp_message(dst + fill + sizeof(len));
+        }
+        fill += sizeof(len) + len;
+    }
+    for (int k = 0; k < n && e; k++) {
+        printf("Message from Producer: %s\n", m);
+    }
+    return fill;
+}
+
+//queue a write of n bytes at p, which lies in registered buffer index
+static void uring_write_fixed(uring_t *u, int fd, char *p, size_t n, int index){
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_WRITE_FIXED;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)p;
+    sqe->len = n;
+    sqe->buf_index = index;
+}
+
+//block for the next completion and return its result
+static int uring_wait_one(uring_t *u){
+    unsigned head = atomic_load_explicit(u->cq_head, memory_order_relaxed);
+    while (head == atomic_load_explicit(u->cq_tail, memory_order_acquire)) {
+        uring_submit(u, 1);
+    }
+    int res = u->cqes[head & *u->cq_mask].res;
+    atomic_store_explicit(u->cq_head, head + 1, memory_order_release);
+    return res;
+}
+
+//streaming producer over io_uring: frames are packed into one of two registered buffers and
+//written with WRITE_FIXED, so one io_uring_enter moves a whole buffer of frames while the
+//other buffer is refilled. Only one write is in flight so frames stay in order on the stream
+void producer_socket_uring(bool e, const char *m, int q){
+    uint32_t len = strlen(m);
+    size_t frame = sizeof(len) + len;
+    if (frame > URING_STAGE) {
+        fprintf(stderr, "Error: %u byte message exceeds the %d byte io_uring staging buffer\n",
+                len, (int)(URING_STAGE - sizeof(len)));
+        exit(EXIT_FAILURE);
+    }
+    int per_write = URING_STAGE / frame;
+    if (batch_size > 1 && batch_size < per_write) per_write = batch_size;
+
+    uring_t u;
+    uring_init(&u, 8);
+    static char stage[2][URING_STAGE];
+    struct iovec regs[2] = { { stage[0], URING_STAGE }, { stage[1], URING_STAGE } };
+    if (syscall(SYS_io_uring_register, u.fd, IORING_REGISTER_BUFFERS, regs, 2) < 0) {
+        perror("IORING_REGISTER_BUFFERS failed");
+        exit(EXIT_FAILURE);
+    }
+    int producer_file = connect_consumer();
+
+    // pack the first buffer, then keep one write in flight while the other buffer is packed
+    int i = 0, cur = 0;
+    size_t fill[2] = {0, 0};
+    fill[cur] = uring_pack(stage[cur], m, len, (q - i < per_write) ? q - i : per_write, e);
+    i += fill[cur] / frame;
+    while (fill[cur] > 0) {
+        size_t off = 0;
+        uring_write_fixed(&u, producer_file, stage[cur], fill[cur], cur);
+        uring_submit(&u, 0);
+        fill[cur ^ 1] = uring_pack(stage[cur ^ 1], m, len, (q - i < per_write) ? q - i : per_write, e);
+        i += fill[cur ^ 1] / frame;
+        while (1) {
+            int res = uring_wait_one(&u);
+            if (res < 0) {
+                errno = -res;
+                perror("Write failed");
+                close(producer_file);
+                exit(EXIT_FAILURE);
+            }
+            off += res;
+            if (off == fill[cur]) {
+                break;
+            }
+            // short write: send the rest before anything from the next buffer
+            uring_write_fixed(&u, producer_file, stage[cur] + off, fill[cur] - off, cur);
+            uring_submit(&u, 0);
+        }
+        fill[cur] = 0;
+        cur ^= 1;
+    }
+    close(producer_file);
+    close(u.fd);
+}
+
+//a ring of provided receive buffers the kernel picks from for multishot recv
+typedef struct{
+    struct io_uring_buf_ring *ring;
+    char *bufs;
+    unsigned tail;
+}uring_bufs_t;
+
+static void uring_bufs_init(uring_t *u, uring_bufs_t *b){
+    size_t ring_len = URING_BUFS * sizeof(struct io_uring_buf);
+    b->ring = mmap(NULL, ring_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    b->bufs = malloc((size_t)URING_BUFS * URING_BUF_SIZE);
+    if (b->ring == MAP_FAILED || b->bufs == NULL) {
+        perror("io_uring buffer allocation failed");
+        exit(EXIT_FAILURE);
+    }
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)b->ring;
+    reg.ring_entries = URING_BUFS;
+    reg.bgid = URING_BGID;
+    if (syscall(SYS_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        perror("IORING_REGISTER_PBUF_RING failed");
+        exit(EXIT_FAILURE);
+    }
+    b->tail = 0;
+    for (int i = 0; i < URING_BUFS; i++) {
+        struct io_uring_buf *buf = &b->ring->bufs[b->tail++ & (URING_BUFS - 1)];
+        buf->addr = (uint64_t)(uintptr_t)(b->bufs + (size_t)i * URING_BUF_SIZE);
+        buf->len = URING_BUF_SIZE;
+        buf->bid = i;
+    }
+    atomic_store_explicit((_Atomic uint16_t *)&b->ring->tail, b->tail, memory_order_release);
+}
+
+//queue buffer bid for reuse; it is handed back to the kernel by the next uring_bufs_publish
+static void uring_bufs_recycle(uring_bufs_t *b, int bid){
+    struct io_uring_buf *buf = &b->ring->bufs[b->tail++ & (URING_BUFS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(b->bufs + (size_t)bid * URING_BUF_SIZE);
+    buf->len = URING_BUF_SIZE;
+    buf->bid = bid;
+}
+
+static void uring_bufs_publish(uring_bufs_t *b){
+    atomic_store_explicit((_Atomic uint16_t *)&b->ring->tail, b->tail, memory_order_release);
+}
+
+static void uring_arm_accept(uring_t *u, int listen_fd){
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = URING_ACCEPT;
+}
+
+static void uring_arm_recv(uring_t *u, int fd, int slot){
+    struct io_uring_sqe *sqe = uring_sqe(u);
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BGID;
+    sqe->user_data = slot;
+}
+
+//feed n received bytes into a connection's buffer, parsing frames as it fills up; returns
+//false if the stream is corrupt
+static bool uring_take(conn_t *c, const char *data, size_t n, bool e, int *messages_received){
+    while (n > 0) {
+        size_t room = sizeof(c->buf) - c->fill;
+        size_t take = n < room ? n : room;
+        if (!stream_mode) {
+            // one message per connection, truncated like the blocking consumer does
+            if (c->fill + take > BUFFER_SIZE - 1) take = BUFFER_SIZE - 1 - c->fill;
+            c->fill += take;
+            memcpy(c->buf + c->fill - take, data, take);
+            return true;
+        }
+        memcpy(c->buf + c->fill, data, take);
+        c->fill += take;
+        data += take;
+        n -= take;
+        ssize_t used = parse_frames(c->buf, c->fill, e, messages_received);
+        if (used < 0) {
+            return false;
+        }
+        memmove(c->buf, c->buf + used, c->fill - used);
+        c->fill -= used;
+    }
+    return true;
+}
+
+//io_uring consumer for unix sockets: every completion reaped in one pass comes from a single
+//io_uring_enter. Like the epoll consumer it exits once every producer connection has closed
+//and at least -P of them have been seen
+void consumer_socket_uring(bool e){
+    static conn_t *conns[MAX_CONNS];
+    static bool closing[MAX_CONNS];
+    int messages_received = 0;
+    int open_conns = 0;
+    int disconnects = 0;
+
+    int producer_file = listen_consumer();
+    fcntl(producer_file, F_SETFL, fcntl(producer_file, F_GETFL) | O_NONBLOCK);
+    uring_t u;
+    uring_init(&u, URING_ENTRIES);
+    uring_bufs_t bufs;
+    uring_bufs_init(&u, &bufs);
+    uring_arm_accept(&u, producer_file);
+
+    printf("Consumer started. Waiting for messages...\n");
+    fflush(stdout);
+
+    bool idle_check = false;
+    while (1) {
+        bench_poll_report();
+        uring_submit(&u, idle_check ? 0 : 1);
+        unsigned head = atomic_load_explicit(u.cq_head, memory_order_relaxed);
+        unsigned tail = atomic_load_explicit(u.cq_tail, memory_order_acquire);
+        bool progress = head != tail;
+        for (; head != tail; head++) {
+            struct io_uring_cqe *cqe = &u.cqes[head & *u.cq_mask];
+            bool more = cqe->flags & IORING_CQE_F_MORE;
+            if (cqe->user_data == URING_ACCEPT) {
+                if (cqe->res >= 0) {
+                    int slot = 0;
+                    while (slot < MAX_CONNS && conns[slot] != NULL) slot++;
+                    conn_t *c = (slot < MAX_CONNS) ? malloc(sizeof(conn_t)) : NULL;
+                    if (c == NULL) {
+                        fprintf(stderr, "Consumer: no room for another producer connection\n");
+                        close(cqe->res);
+                    } else {
+                        c->fd = cqe->res;
+                        c->fill = 0;
+                        conns[slot] = c;
+                        closing[slot] = false;
+                        open_conns++;
+                        uring_arm_recv(&u, c->fd, slot);
+                    }
+                } else if (cqe->res != -EAGAIN && cqe->res != -EINTR) {
+                    errno = -cqe->res;
+                    perror("Accept failed");
+                }
+                if (!more) {
+                    uring_arm_accept(&u, producer_file);
+                }
+                continue;
+            }
+
+            int slot = cqe->user_data;
+            conn_t *c = conns[slot];
+            if (cqe->res > 0) {
+                int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+                if (!closing[slot] &&
+                    !uring_take(c, bufs.bufs + (size_t)bid * URING_BUF_SIZE, cqe->res, e, &messages_received)) {
+                    // stop receiving; the final completion after the shutdown closes it
+                    closing[slot] = true;
+                    shutdown(c->fd, SHUT_RDWR);
+                }
+                uring_bufs_recycle(&bufs, bid);
+                if (!more) {
+                    uring_arm_recv(&u, c->fd, slot);
+                }
+                continue;
+            }
+            if (cqe->res == -ENOBUFS && !closing[slot]) {
+                // every provided buffer was in use; they are recycled by the end of this pass
+                if (!more) {
+                    uring_arm_recv(&u, c->fd, slot);
+                }
+                continue;
+            }
+            if (more) {
+                continue;
+            }
+            // end of stream, or an error that ended the multishot recv
+            if (cqe->res < 0) {
+                errno = -cqe->res;
+                perror("Read failed");
+            } else if (!stream_mode && c->fill > 0) {
+                messages_received++;
+                bench_record(c->buf, c->fill);
+                if(e)
+                {
+                    printf("Consumer received: %.*s (message %d)\n", (int)c->fill, c->buf, messages_received);
+                }
+            } else if (c->fill > 0 && !closing[slot]) {
+                fprintf(stderr, "Consumer: connection closed inside a frame\n");
+            }
+            close(c->fd);
+            free(c);
+            conns[slot] = NULL;
+            open_conns--;
+            disconnects++;
+        }
+        atomic_store_explicit(u.cq_head, head, memory_order_release);
+        uring_bufs_publish(&bufs);
+
+        // Idle shutdown: every producer seen so far has gone, and one more pass that waits
+        // for nothing finds no connection the multishot accept had already taken
+        if (producers_gone(open_conns, disconnects)) {
+            if (idle_check && !progress) {
+                printf("All %d producers disconnected.\n", disconnects);
+                break;
+            }
+            idle_check = true;
+        } else {
+            idle_check = false;
+        }
+    }
+
+    printf("All messages consumed (%d total). Exiting.\n", messages_received);
+    close(u.fd);
+    close(producer_file);
+    unlink(names.socket);
+}
+
+//open a channel's queue segment: the -J journal file, from hugetlbfs with -H and from POSIX
+//shm otherwise
+static int open_segment(const channel_names_t *n, bool huge, int flags){
+    if (journal_path != NULL) {
+        return open(journal_path, flags, 0644);
+    }
+    if (huge) {
+        return open(n->huge, flags, 0666);
+    }
+    return shm_open(n->shm, flags, 0666);
+}
+
+//false for a fresh zero-filled segment, true for one laid out by this build; a segment
+//written by an incompatible build is refused rather than guessed at
+static bool segment_initialised(const queue_t *h){
+    if (h->magic == 0) {
+        return false;
+    }
+    if (h->magic != QUEUE_MAGIC || h->version != QUEUE_VERSION) {
+        fprintf(stderr, "Error: shared memory segment has magic %#x version %u, expected %#x version %u; remove %s\n",
+                h->magic, h->version, QUEUE_MAGIC, QUEUE_VERSION, huge_pages ? names.huge : names.shm);
+        exit(EXIT_FAILURE);
+    }
+    return true;
+}
+
+//map the channel directory, creating it on first use, and lock it with its semaphore
+static directory_t *open_directory(sem_t **lock){
+    *lock = sem_open(SEM_DIR, O_CREAT, 0666, 1);
+    if (*lock == SEM_FAILED) {
+        perror("sem_open failed");
+        exit(EXIT_FAILURE);
+    }
+    int dir_fd = shm_open(DIR_NAME, O_CREAT | O_RDWR, 0666);
+    if (dir_fd == -1) {
+        perror("shm_open failed");
+        exit(EXIT_FAILURE);
+    }
+    struct stat dir_stat;
+    if (fstat(dir_fd, &dir_stat) == -1) {
+        perror("fstat failed");
+        exit(EXIT_FAILURE);
+    }
+    if ((size_t)dir_stat.st_size < sizeof(directory_t) && ftruncate(dir_fd, sizeof(directory_t)) == -1) {
+        perror("ftruncate failed");
+        exit(EXIT_FAILURE);
+    }
+    directory_t *dir = mmap(NULL, sizeof(directory_t), PROT_READ | PROT_WRITE, MAP_SHARED, dir_fd, 0);
+    close(dir_fd);
+    if (dir == MAP_FAILED) {
+        perror("mmap failed");
+        exit(EXIT_FAILURE);
+    }
+    sem_wait(*lock);
+    return dir;
+}
+
+static void close_directory(directory_t *dir, sem_t *lock){
+    sem_post(lock);
+    munmap(dir, sizeof(directory_t));
+    sem_close(lock);
+}
+
+//record the selected channel in the directory, reusing its entry if it is already listed
+static void register_channel(int mode, int q, size_t ring_bytes){
+    sem_t *lock;
+    directory_t *dir = open_directory(&lock);
+    channel_t *entry = NULL;
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        channel_t *c = &dir->channels[i];
+        if (c->used && strcmp(c->topic, names.topic) == 0) {
+            entry = c;
+            break;
+        }
+        if (!c->used && entry == NULL) {
+            entry = c;
+        }
+    }
+    if (entry == NULL) {
+        fprintf(stderr, "Warning: channel directory is full, %s is not listed\n", names.topic);
+    } else {
+        entry->mode = mode;
+        entry->q_size = q;
+        entry->ring_bytes = ring_bytes;
+        entry->huge = huge_pages;
+        snprintf(entry->topic, sizeof(entry->topic), "%s", names.topic);
+        entry->used = true;
+    }
+    close_directory(dir, lock);
+}
+
+//-L: print every listed channel with its queue occupancy, dropping entries whose segment is gone
+void list_channels(){
+    sem_t *lock;
+    directory_t *dir = open_directory(&lock);
+    printf("%-*s %-6s %8s %12s %10s\n", CHANNEL_NAME, "channel", "mode", "depth", "ring bytes", "pending");
+    for (int i = 0; i < MAX_CHANNELS; i++) {
+        channel_t *c = &dir->channels[i];
+        if (!c->used) {
+            continue;
+        }
+        channel_names_t n;
+        channel_names(c->topic, &n);
+        int fd = open_segment(&n, c->huge, O_RDONLY);
+        if (fd == -1) {
+            c->used = false;
+            continue;
+        }
+        queue_t *h = mmap(NULL, sizeof(queue_t), PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (h == MAP_FAILED) {
+            continue;
+        }
+        // head and tail are slot indices in QUEUE_SEM, so its occupancy comes from the full semaphore
+        long pending = -1;
+        if (h->magic == QUEUE_MAGIC && h->mode == QUEUE_SEM) {
+            sem_t *chan_full = sem_open(n.full, 0);
+            if (chan_full != SEM_FAILED) {
+                int val = 0;
+                sem_getvalue(chan_full, &val);
+                pending = val;
+                sem_close(chan_full);
+            }
+        } else if (h->magic == QUEUE_MAGIC) {
+            pending = (long)(atomic_load(&h->head) - atomic_load(&h->tail));
+            if (h->mode == QUEUE_BYTES) {
+                pending = -1;
+            }
+        }
+        printf("%-*s %-6s %8d %12llu ", CHANNEL_NAME, c->topic[0] ? c->topic : "(default)",
+               queue_mode_names[c->mode], c->q_size, (unsigned long long)c->ring_bytes);
+        if (pending < 0) {
+            printf("%10s\n", "-");
+        } else {
+            printf("%10ld\n", pending);
+        }
+        munmap(h, sizeof(queue_t));
+    }
+    close_directory(dir, lock);
+}
+
+//snapshot the live counters of a mapped segment
+static void load_stats(const queue_t *h, queue_stats_t *cur){
+    cur->enqueued = atomic_load_explicit(&h->stats.enqueued, memory_order_relaxed);
+    cur->bytes_in = atomic_load_explicit(&h->stats.bytes_in, memory_order_relaxed);
+    cur->full_waits = atomic_load_explicit(&h->stats.full_waits, memory_order_relaxed);
+    cur->full_wait_ns = atomic_load_explicit(&h->stats.full_wait_ns, memory_order_relaxed);
+    cur->high_water = atomic_load_explicit(&h->stats.high_water, memory_order_relaxed);
+    cur->dropped = atomic_load_explicit(&h->stats.dropped, memory_order_relaxed);
+    cur->overwritten = atomic_load_explicit(&h->stats.overwritten, memory_order_relaxed);
+    cur->dequeued = atomic_load_explicit(&h->stats.dequeued, memory_order_relaxed);
+    cur->bytes_out = atomic_load_explicit(&h->stats.bytes_out, memory_order_relaxed);
+    cur->empty_waits = atomic_load_explicit(&h->stats.empty_waits, memory_order_relaxed);
+    cur->empty_wait_ns = atomic_load_explicit(&h->stats.empty_wait_ns, memory_order_relaxed);
+    cur->gaps = atomic_load_explicit(&h->stats.gaps, memory_order_relaxed);
+    cur->lost = atomic_load_explicit(&h->stats.lost, memory_order_relaxed);
+}
+
+//-S: attach read-only to the selected channel and print its counters every interval_ms, as
+//per-second rates since the previous sample, until samples lines have been printed (0 = forever)
+void stats_reader(int interval_ms, int samples){
+    int fd = open_segment(&names, huge_pages, O_RDONLY);
+    if (fd == -1) {
+        perror("Stats: shm_open failed. Make sure a producer has created the shared memory");
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(queue_t)) {
+        fprintf(stderr, "Stats: shared memory segment is too small\n");
+        exit(EXIT_FAILURE);
+    }
+    queue_t *h = mmap(NULL, sizeof(queue_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (h == MAP_FAILED) {
+        perror("Stats: mmap failed");
+        exit(EXIT_FAILURE);
+    }
+    if (!segment_initialised(h)) {
+        fprintf(stderr, "Stats: shared memory has not been initialised by a producer\n");
+        exit(EXIT_FAILURE);
+    }
+
+    queue_stats_t prev;
+    load_stats(h, &prev);
+    uint64_t prev_time = now_ns();
+    for (int line = 0; samples == 0 || line < samples; line++) {
+        struct timespec interval = { interval_ms / 1000, (interval_ms % 1000) * 1000000L };
+        nanosleep(&interval, NULL);
+        if (line % 20 == 0) {
+            printf("%10s %10s %10s %8s %8s %8s %8s %8s %8s %8s %10s %10s\n", "enq/s", "deq/s", "MB/s",
+                   "full/s", "empty/s", "pwait%", "cwait%", "drop/s", "lost/s", "occ", "hwm", "total");
+        }
+        queue_stats_t cur;
+        load_stats(h, &cur);
+        uint64_t now = now_ns();
+        double secs = (now - prev_time) / 1e9;
+        // QUEUE_SEM head and tail are slot indices, so its occupancy comes from the counters
+        uint64_t occupancy = (h->mode == QUEUE_SEM) ? cur.enqueued - cur.dequeued :
+                             atomic_load_explicit(&h->head, memory_order_relaxed) -
+                             atomic_load_explicit(&h->tail, memory_order_relaxed);
+        // an overwriting producer runs ahead of a stalled consumer but the ring holds q_size at most
+        if (h->policy == POLICY_OVERWRITE && occupancy > (uint64_t)h->q_size) {
+            occupancy = h->q_size;
+        }
+        printf("%10.0f %10.0f %10.2f %8.0f %8.0f %8.1f %8.1f %8.0f %8.0f %8llu %10llu %10llu\n",
+               (cur.enqueued - prev.enqueued) / secs, (cur.dequeued - prev.dequeued) / secs,
+               (cur.bytes_in - prev.bytes_in) / secs / 1e6,
+               (cur.full_waits - prev.full_waits) / secs, (cur.empty_waits - prev.empty_waits) / secs,
+               (cur.full_wait_ns - prev.full_wait_ns) / (secs * 1e7),
+               (cur.empty_wait_ns - prev.empty_wait_ns) / (secs * 1e7),
+               (cur.dropped + cur.overwritten - prev.dropped - prev.overwritten) / secs,
+               (cur.lost - prev.lost) / secs,
+               (unsigned long long)occupancy, (unsigned long long)cur.high_water,
+               (unsigned long long)cur.dequeued);
+        fflush(stdout);
+        prev = cur;
+        prev_time = now;
+    }
+    munmap(h, sizeof(queue_t));
+}
+
+//msync the whole pages backing len bytes at p
+static void sync_range(void *p, size_t len){
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t start = (uintptr_t)p & ~(page - 1);
+    if (msync((void *)start, (uintptr_t)p + len - start, MS_SYNC) == -1) {
+        perror("msync failed");
+        exit(EXIT_FAILURE);
+    }
+}
+
+//msync the ring between positions from and to, in two pieces if it wraps
+static void sync_ring(uint64_t from, uint64_t to){
+    uint64_t scale = (q_t->mode == QUEUE_BYTES) ? 1 : BUFFER_SIZE;
+    uint64_t ring = q_t->ring_bytes;
+    uint64_t off = (from * scale) % ring;
+    uint64_t len = (to - from) * scale;
+    if (len >= ring) {
+        sync_range(q_t->messages, ring);
+    } else if (off + len > ring) {
+        sync_range(q_t->messages + off, ring - off);
+        sync_range(q_t->messages, off + len - ring);
+    } else if (len > 0) {
+        sync_range(q_t->messages + off, len);
+    }
+}
+
+static void waitword_notify(waitword_t *w);
+
+//group commit: a producer flushes the records appended since the last commit and only then
+//moves durable up to them, which is what hands them to consumers; a consumer flushes its read
+//cursor, so a restart resumes there and re-delivers at most the messages released since
+//(at least once)
+static void journal_sync(bool producer){
+    if (producer) {
+        uint64_t head = atomic_load_explicit(&q_t->head, memory_order_relaxed);
+        uint64_t durable = atomic_load_explicit(&q_t->durable, memory_order_relaxed);
+        if (head != durable) {
+            sync_ring(durable, head);
+            atomic_store_explicit(&q_t->durable, head, memory_order_release);
+            sync_range(&q_t->durable, sizeof(q_t->durable));
+            waitword_notify(&q_t->not_empty);
+        }
+    } else {
+        sync_range(&q_t->tail, sizeof(q_t->tail));
+    }
+    journal_pending = 0;
+    journal_last_sync = now_ns();
+    journal_syncs++;
+}
+
+//a -J producer about to block, on a full ring or on its input: commit what is pending first,
+//since consumers cannot read it before then and may be what the producer is waiting on
+static void journal_flush(){
+    if (journal_path != NULL &&
+        atomic_load_explicit(&q_t->head, memory_order_relaxed) !=
+        atomic_load_explicit(&q_t->durable, memory_order_relaxed)) {
+        journal_sync(true);
+    }
+}
+
+//count n messages committed or released and group-commit once -G or -I is reached
+static void journal_progress(uint64_t n, bool producer){
+    if (journal_path == NULL) {
+        return;
+    }
+    journal_pending += n;
+    if (journal_pending >= (uint64_t)group_messages ||
+        now_ns() - journal_last_sync >= (uint64_t)group_us * 1000) {
+        journal_sync(producer);
+    }
+}
+
+//run by the first process to open the journal, which the exclusive flock proves is the only
+//one (see journal_lock): whatever the header says about live producers, consumers and
+//waiters was left behind by processes that died. Records past durable may never have reached
+//the disk, so the ring is cut back to it; no consumer read past durable, so none of them
+//were delivered
+static void journal_recover(){
+    uint64_t durable = atomic_load(&q_t->durable);
+    if (atomic_load(&q_t->head) != durable) {
+        printf("Journal: discarding %llu unsynced positions past the last group commit\n",
+               (unsigned long long)(atomic_load(&q_t->head) - durable));
+        atomic_store(&q_t->head, durable);
+    }
+    if (atomic_load(&q_t->tail) > durable) {
+        atomic_store(&q_t->tail, durable);
+    }
+    atomic_store(&q_t->consumers, 0);
+    atomic_store(&q_t->producers, 0);
+    // -P counts the producers of this session, not those that finished before the restart
+    atomic_store(&q_t->finished, 0);
+    atomic_store(&q_t->done, 1);
+    atomic_store(&q_t->not_empty.waiters, 0);
+    atomic_store(&q_t->not_full.waiters, 0);
+    memset(q_t->cursors, 0, sizeof(q_t->cursors));
+    printf("Journal: resuming with %llu positions unread\n",
+           (unsigned long long)(durable - atomic_load(&q_t->tail)));
+}
+
+//take this process's shared flock on the journal open at fd, recovering it first when no other
+//process holds one. flock cannot downgrade atomically, so the probe, the recovery and the
+//shared lock all happen under an exclusive flock on <journal>.lock; otherwise a second process
+//could find the journal unlocked in the gap and recover it while this one is using it
+static void journal_lock(int fd, bool live){
+    char lock_path[PATH_MAX];
+    snprintf(lock_path, sizeof(lock_path), "%s.lock", journal_path);
+    int lock_fd = open(lock_path, O_CREAT | O_RDWR, 0644);
+    if (lock_fd == -1) {
+        perror("Journal: opening the lock file failed");
+        exit(EXIT_FAILURE);
+    }
+    if (flock(lock_fd, LOCK_EX) == -1) {
+        perror("Journal: flock on the lock file failed");
+        exit(EXIT_FAILURE);
+    }
+    if (flock(fd, LOCK_EX | LOCK_NB) == 0) {
+        if (live) {
+            journal_recover();
+        }
+    } else if (errno != EWOULDBLOCK) {
+        perror("Journal: flock failed");
+        exit(EXIT_FAILURE);
+    }
+    if (flock(fd, LOCK_SH) == -1) {
+        perror("Journal: flock failed");
+        exit(EXIT_FAILURE);
+    }
+    // closing the lock file releases it
+    close(lock_fd);
+}
+
+//function to create section of shared memory
+void create_sharedmem(int q, int mode, size_t ring_bytes){
+    int shm_fd = open_segment(&names, huge_pages, O_CREAT | O_RDWR);
+    if (shm_fd == -1) {
+        perror("shm_open failed");
+        exit(EXIT_FAILURE);
+    }
+    
+    struct stat shm_stat;
+    if (fstat(shm_fd, &shm_stat) == -1) {
+        perror("fstat failed");
+        exit(EXIT_FAILURE);
+    }
+    
+    // QUEUE_BYTES is sized in bytes, the slot modes in BUFFER_SIZE slots
+    if (mode != QUEUE_BYTES) {
+        ring_bytes = (size_t)q * BUFFER_SIZE;
+    }
+    size_t needed_size = sizeof(queue_t) + ring_bytes;
+    size_t existing_size = shm_stat.st_size;
+    
+    // If shared memory already exists, determine its queue size
+    if (existing_size > sizeof(queue_t)) {
+        queue_t *temp = mmap(NULL, sizeof(queue_t), PROT_READ, MAP_SHARED, shm_fd, 0);
+        if (temp == MAP_FAILED) {
+            perror("mmap failed during size check");
+            exit(EXIT_FAILURE);
+        }
+        size_t existing_bytes = segment_initialised(temp) ? temp->ring_bytes : 0;
+        munmap(temp, sizeof(queue_t));
+        
+        // Update needed size to use the larger of the two queue sizes
+        if (existing_bytes > ring_bytes) {
+            needed_size = sizeof(queue_t) + existing_bytes;
+        }
+    }
+    
+    // hugetlbfs files can only be sized and mapped in whole huge pages
+    if (huge_pages) {
+        needed_size = (needed_size + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1);
+    }
+
+    // Resize shared memory to accommodate the larger queue if needed
+    if (needed_size > existing_size) {
+        if (ftruncate(shm_fd, needed_size) == -1) {
+            perror("ftruncate failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // Map the shared memory, prefaulted so the first messages don't take page faults
+    q_t = mmap(NULL, needed_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, shm_fd, 0);
+    if (q_t == MAP_FAILED) {
+        perror("mmap failed");
+        exit(EXIT_FAILURE);
+    }
+    shm_size = needed_size;
+    // refuse a foreign layout before taking the mutex, so exiting cannot leave it held
+    bool journal_live = segment_initialised(q_t);
+    // every process holds a shared flock on the journal until it exits, however it exits
+    if (journal_path != NULL) {
+        journal_lock(shm_fd, journal_live);
+        journal_last_sync = now_ns();
+    }
+    
+    sem_wait(mutex);
+    // A finished and fully drained queue is left behind by earlier runs, so start it afresh.
+    // head wraps in QUEUE_SEM, so there the full semaphore tells whether messages remain
+    int full_val = 0;
+    if (q_t->mode == QUEUE_SEM) {
+        sem_getvalue(full, &full_val);
+    }
+    // An attached consumer may still be reading slots that tail has already passed (QUEUE_MPMC
+    // frees them only at release), so the queue is only restarted once every consumer has left
+    bool fresh = q_t->magic != QUEUE_MAGIC;
+    bool idle = !fresh && q_t->done && q_t->head == q_t->tail && full_val == 0 &&
+                atomic_load(&q_t->consumers) == 0;
+    // broadcast consumers waiting on an empty ring hold cursors into it
+    for (int i = 0; i < MAX_CURSORS && idle; i++) {
+        idle = !q_t->cursors[i].active;
+    }
+    if(fresh){
+        // finished survives idle restarts so a -P consumer still counts producers that
+        // came and went before it attached
+        q_t->finished = 0;
+        q_t->magic = QUEUE_MAGIC;
+        q_t->version = QUEUE_VERSION;
+    }
+    if(fresh || idle){
+        q_t->head = 0;
+        q_t->durable = 0;
+        q_t->tail = 0;
+        q_t->q_size = q;
+        q_t->running = 1;
+        // a drained journal stays done, so a consumer opening it only waits for -P producers
+        // rather than forever; producer_attach clears done anyway
+        if (fresh || journal_path == NULL) {
+            q_t->done = 0;
+        }
+        q_t->mode = mode;
+        q_t->policy = overflow_policy;
+        q_t->producers = 0;
+        q_t->ring_bytes = ring_bytes;
+        memset(q_t->cursors, 0, sizeof(q_t->cursors));
+        for (int i = 0; i < q && mode != QUEUE_BYTES; i++) 
+        {
+            memset(&q_t->messages[i * BUFFER_SIZE], 0, BUFFER_SIZE);
+            if (mode == QUEUE_MPMC) {
+                atomic_store(&((slot_t *)&q_t->messages[i * BUFFER_SIZE])->seq, i);
+            }
+        }
+    }
+    else if (q_t->mode != mode) {
+        fprintf(stderr, "Error: shared memory queue is already running in another -M mode\n");
+        sem_post(mutex);
+        exit(EXIT_FAILURE);
+    }
+    else if (q_t->policy != overflow_policy) {
+        fprintf(stderr, "Error: shared memory queue is already running with another -O policy\n");
+        sem_post(mutex);
+        exit(EXIT_FAILURE);
+    }
+    else if (q > q_t->q_size && mode != QUEUE_SEM) {
+        // Lock-free slots are addressed modulo q_size, so the ring cannot grow under live indices
+        printf("Keeping existing queue size %d (lock-free queues cannot grow)\n", q_t->q_size);
+    }
+    else if (q > q_t->q_size) {
+        // Expand the queue size if needed
+        printf("Expanding queue from %d to %d\n", q_t->q_size, q);
+        
+        // Initialize new message slots
+        for (int i = q_t->q_size; i < q; i++) 
+        {
+            memset(&q_t->messages[i * BUFFER_SIZE], 0, BUFFER_SIZE);
+        }
+        
+        q_t->q_size = q;
+        q_t->ring_bytes = ring_bytes;
+    }
+    
+    int listed_mode = q_t->mode, listed_size = q_t->q_size;
+    size_t listed_bytes = q_t->ring_bytes;
+    sem_post(mutex);
+    register_channel(listed_mode, listed_size, listed_bytes);
+}
+
+//shared (not FUTEX_PRIVATE) futex call, since the word is mapped by several processes
+static long futex(_Atomic uint32_t *addr, int op, uint32_t val, const struct timespec *timeout){
+    return syscall(SYS_futex, addr, op, val, timeout, NULL, 0);
+}
+
+//wake everyone parked on w; the fence pairs with the one in waitword_wait so either the
+//waiter sees the caller's publish or the caller sees the waiter registered
+static void waitword_notify(waitword_t *w){
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&w->waiters, memory_order_relaxed) > 0) {
+        atomic_fetch_add(&w->seq, 1);
+        futex(&w->seq, FUTEX_WAKE, INT_MAX, NULL);
+    }
+}
+
+//how long a waiter parked on w sleeps before rechecking on its own, or NULL to sleep until
+//woken. A QUEUE_BCAST producer waiting for room may be waiting on a consumer that died with its
+//cursor registered, which nobody will ever wake it for, so it looks again every CURSOR_CHECK_MS.
+//A -j consumer wakes every REPORT_CHECK_MS to see whether SIGUSR1 asked for a report, since the
+//futex wait is restarted after the handler runs
+static const struct timespec *park_timeout(waitword_t *w){
+    static const struct timespec cursor_check = {0, CURSOR_CHECK_MS * 1000000L};
+    static const struct timespec report_check = {0, REPORT_CHECK_MS * 1000000L};
+    if (q_t->mode == QUEUE_BCAST && w == &q_t->not_full) {
+        return &cursor_check;
+    }
+    if (bench_mode && w == &q_t->not_empty) {
+        return &report_check;
+    }
+    return NULL;
+}
+
+//park on w unless ready(arg) already holds; may return spuriously, callers recheck
+static void waitword_wait(waitword_t *w, bool (*ready)(void *), void *arg){
+    atomic_fetch_add(&w->waiters, 1);
+    uint32_t seq = atomic_load(&w->seq);
+    atomic_thread_fence(memory_order_seq_cst);
+    if (!ready(arg)) {
+        futex(&w->seq, FUTEX_WAIT, seq, park_timeout(w));
+    }
+    atomic_fetch_sub(&w->waiters, 1);
+}
+
+//producers have declared the queue finished, and at least -P of them have
+static bool queue_done(){
+    return atomic_load_explicit(&q_t->done, memory_order_acquire) &&
+           atomic_load_explicit(&q_t->finished, memory_order_acquire) >= expected_producers;
+}
+
+//this process's QUEUE_BCAST cursor, claimed by bcast_register
+int my_cursor = -1;
+
+//position of the slowest registered QUEUE_BCAST consumer, or the current floor if none is
+static uint64_t bcast_slowest(){
+    uint64_t slowest = UINT64_MAX;
+    for (int i = 0; i < MAX_CURSORS; i++) {
+        if (atomic_load_explicit(&q_t->cursors[i].active, memory_order_acquire)) {
+            uint64_t pos = atomic_load_explicit(&q_t->cursors[i].pos, memory_order_acquire);
+            if (pos < slowest) slowest = pos;
+        }
+    }
+    if (slowest == UINT64_MAX) {
+        slowest = atomic_load_explicit(&q_t->tail, memory_order_acquire);
+    }
+    return slowest;
+}
+
+//reclaim the cursors of QUEUE_BCAST consumers that exited without bcast_unregister, along with
+//their attach, at most once every CURSOR_CHECK_MS since it costs a kill() per cursor
+static void bcast_reap(){
+    static uint64_t last_check;
+    uint64_t now = now_ns();
+    if (now - last_check < CURSOR_CHECK_MS * 1000000ull) {
+        return;
+    }
+    last_check = now;
+    sem_wait(mutex);
+    for (int i = 0; i < MAX_CURSORS; i++) {
+        if (atomic_load(&q_t->cursors[i].active) &&
+            kill(atomic_load(&q_t->cursors[i].owner), 0) == -1 && errno == ESRCH) {
+            atomic_store(&q_t->cursors[i].active, 0);
+            atomic_fetch_sub(&q_t->consumers, 1);
+            fprintf(stderr, "Producer: reclaimed the cursor of exited consumer %d\n",
+                    atomic_load(&q_t->cursors[i].owner));
+        }
+    }
+    sem_post(mutex);
+}
+
+//how far a consumer may read: head, or under -J only what the last group commit made durable,
+//so journal_recover never cuts back records a consumer already delivered
+static uint64_t readable_head(){
+    if (journal_path != NULL) {
+        return atomic_load_explicit(&q_t->durable, memory_order_acquire);
+    }
+    return atomic_load_explicit(&q_t->head, memory_order_acquire);
+}
+
+//wake-up condition for a consumer parked on not_empty
+static bool queue_readable(void *arg){
+    (void)arg;
+    if (queue_done()) {
+        return true;
+    }
+    if (q_t->mode == QUEUE_SEM) {
+        int full_val;
+        sem_getvalue(full, &full_val);
+        return full_val > 0;
+    }
+    if (q_t->mode == QUEUE_BCAST) {
+        return atomic_load_explicit(&q_t->head, memory_order_acquire) !=
+               atomic_load_explicit(&q_t->cursors[my_cursor].pos, memory_order_relaxed);
+    }
+    return readable_head() != atomic_load_explicit(&q_t->tail, memory_order_acquire);
+}
+
+//wake-up condition for a producer parked on not_full
+static bool queue_writable(void *arg){
+    (void)arg;
+    if (q_t->mode == QUEUE_SEM) {
+        int empty_val;
+        sem_getvalue(empty, &empty_val);
+        return empty_val > 0;
+    }
+    if (q_t->mode == QUEUE_BCAST) {
+        bcast_reap();
+        return atomic_load_explicit(&q_t->head, memory_order_relaxed) - bcast_slowest() < (uint64_t)q_t->q_size;
+    }
+    return atomic_load_explicit(&q_t->head, memory_order_acquire) -
+           atomic_load_explicit(&q_t->tail, memory_order_acquire) < (uint64_t)q_t->q_size;
+}
+
+//pause instruction for spin loops, so a spinning hyperthread yields pipeline resources
+static inline void cpu_relax(void){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#else
+    atomic_signal_fence(memory_order_seq_cst);
+#endif
+}
+
+//wait until ready(arg) holds using the -w policy: spin with pause, spin SPIN_LIMIT times then
+//sched_yield, spin SPIN_LIMIT times then park on the futex w, or park on w straight away
+static void wait_until(waitword_t *w, bool (*ready)(void *), void *arg){
+    unsigned spins = 0;
+    wait_stats.waits++;
+    if (ready(arg)) {
+        return;
+    }
+    uint64_t start = now_ns();
+    while (!ready(arg)) {
+        bench_poll_report();
+        if (wait_policy == WAIT_BLOCK || (wait_policy == WAIT_PARK && spins >= SPIN_LIMIT)) {
+            wait_stats.parks++;
+            waitword_wait(w, ready, arg);
+        } else if (wait_policy == WAIT_YIELD && spins >= SPIN_LIMIT) {
+            wait_stats.yields++;
+            sched_yield();
+        } else {
+            spins++;
+            wait_stats.spins++;
+            cpu_relax();
+        }
+    }
+    uint64_t waited = now_ns() - start;
+    if (w == &q_t->not_full) {
+        atomic_fetch_add_explicit(&q_t->stats.full_waits, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&q_t->stats.full_wait_ns, waited, memory_order_relaxed);
+    } else {
+        atomic_fetch_add_explicit(&q_t->stats.empty_waits, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&q_t->stats.empty_wait_ns, waited, memory_order_relaxed);
+    }
+}
+
+//count n messages of bytes total entering the queue and raise the occupancy high-water mark
+static void stats_enqueued(uint64_t n, uint64_t bytes, uint64_t occupancy){
+    atomic_fetch_add_explicit(&q_t->stats.enqueued, n, memory_order_relaxed);
+    atomic_fetch_add_explicit(&q_t->stats.bytes_in, bytes, memory_order_relaxed);
+    uint64_t high = atomic_load_explicit(&q_t->stats.high_water, memory_order_relaxed);
+    while (occupancy > high &&
+           !atomic_compare_exchange_weak_explicit(&q_t->stats.high_water, &high, occupancy,
+                                                  memory_order_relaxed, memory_order_relaxed));
+}
+
+static void stats_dequeued(uint64_t n, uint64_t bytes){
+    atomic_fetch_add_explicit(&q_t->stats.dequeued, n, memory_order_relaxed);
+    atomic_fetch_add_explicit(&q_t->stats.bytes_out, bytes, memory_order_relaxed);
+}
+
+//payload bytes described by a run
+static uint64_t run_bytes(const run_t *r){
+    uint64_t bytes = 0;
+    for (int k = 0; k < r->n; k++) {
+        bytes += r->len[k];
+    }
+    return bytes;
+}
+
+//print the wait counters for this process's policy
+void print_wait_stats(){
+    printf("Wait policy %s: %lu waits, %lu spins, %lu yields, %lu parks\n",
+           wait_policy_names[wait_policy], wait_stats.waits, wait_stats.spins,
+           wait_stats.yields, wait_stats.parks);
+}
+
+//print this process's back-pressure counters when a lossy -O policy is in force
+void print_loss_stats(){
+    if (q_t->policy == POLICY_BLOCK) {
+        return;
+    }
+    printf("Back-pressure %s: %lu dropped, %lu overwritten, %lu gaps, %lu messages lost\n",
+           overflow_policy_names[q_t->policy], loss_stats.dropped, loss_stats.overwritten,
+           loss_stats.gaps, loss_stats.lost);
+}
+
+//an empty run at head, which is what a full ring reserves under POLICY_DROP
+static int reserve_none(run_t *r, uint64_t head){
+    r->pos = head;
+    r->end = head;
+    r->n = 0;
+    return 0;
+}
+
+//copy a message into a slot of cap bytes without strncpy's zero padding of the whole slot
+static void copy_message(char *slot, const char *m, size_t cap){
+    size_t len = strnlen(m, cap - 1);
+    memcpy(slot, m, len);
+    slot[len] = '\0';
+}
+
+//bytes a QUEUE_BYTES record of len payload bytes occupies, header and padding included
+static uint64_t record_size(size_t len){
+    return (sizeof(record_t) + len + RECORD_ALIGN - 1) & ~(uint64_t)(RECORD_ALIGN - 1);
+}
+
+//wake-up condition for a QUEUE_BYTES producer that needs *arg free bytes
+static bool ring_has_room(void *arg){
+    uint64_t need = *(uint64_t *)arg;
+    return atomic_load_explicit(&q_t->head, memory_order_relaxed) + need -
+           atomic_load_explicit(&q_t->tail, memory_order_acquire) <= q_t->ring_bytes;
+}
+
+//slot that ring position pos maps to in QUEUE_SPSC and QUEUE_MPMC
+static char *ring_slot(uint64_t pos){
+    return &q_t->messages[(pos % q_t->q_size) * BUFFER_SIZE];
+}
+
+static slot_t *mpmc_slot(uint64_t pos){
+    return (slot_t *)ring_slot(pos);
+}
+
+//QUEUE_SPSC reserve: head is only written by the producer and tail only by the consumer, so
+//the free slots between them can be handed out without any atomic read-modify-write
+static int spsc_reserve(run_t *r, int want){
+    uint64_t size = q_t->q_size;
+    uint64_t head = atomic_load_explicit(&q_t->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&q_t->tail, memory_order_acquire);
+    while (head - tail >= size) {
+        if (q_t->policy == POLICY_DROP) {
+            return reserve_none(r, head);
+        }
+        journal_flush();
+        wait_until(&q_t->not_full, queue_writable, NULL);
+        tail = atomic_load_explicit(&q_t->tail, memory_order_acquire);
+    }
+
+    uint64_t n = size - (head - tail);
+    if (n > (uint64_t)want) n = want;
+    for (uint64_t k = 0; k < n; k++) {
+        r->msg[k] = ring_slot(head + k);
+        r->len[k] = BUFFER_SIZE;
+    }
+    r->pos = head;
+    r->end = head + n;
+    r->n = n;
+    return n;
+}
+
+//QUEUE_BCAST reserve (single producer): the floor is only recomputed from the cursors, under
+//the channel mutex that registration also takes, once the ring looks full against it, so a
+//consumer can never register behind a floor that has already been passed
+static int bcast_reserve(run_t *r, int want){
+    uint64_t size = q_t->q_size;
+    uint64_t head = atomic_load_explicit(&q_t->head, memory_order_relaxed);
+    uint64_t floor = atomic_load_explicit(&q_t->tail, memory_order_acquire);
+    while (head - floor >= size) {
+        sem_wait(mutex);
+        floor = bcast_slowest();
+        atomic_store_explicit(&q_t->tail, floor, memory_order_release);
+        sem_post(mutex);
+        if (head - floor < size) {
+            break;
+        }
+        if (q_t->policy == POLICY_DROP) {
+            return reserve_none(r, head);
+        }
+        wait_until(&q_t->not_full, queue_writable, NULL);
+    }
+
+    uint64_t n = size - (head - floor);
+    if (n > (uint64_t)want) n = want;
+    for (uint64_t k = 0; k < n; k++) {
+        r->msg[k] = ring_slot(head + k);
+        r->len[k] = BUFFER_SIZE;
+    }
+    r->pos = head;
+    r->end = head + n;
+    r->n = n;
+    return n;
+}
+
+//QUEUE_SPSC commit: one release store of head publishes the whole run
+static void spsc_commit(run_t *r){
+    atomic_store_explicit(&q_t->head, r->end, memory_order_release);
+}
+
+//QUEUE_SPSC peek: every slot between tail and the published head is readable in place
+static int spsc_peek(run_t *r, int max){
+    uint64_t tail = atomic_load_explicit(&q_t->tail, memory_order_relaxed);
+    uint64_t head;
+    while ((head = readable_head()) == tail) {
+        // done is stored after the last head, so recheck head once done is seen
+        if (queue_done() && readable_head() == tail) {
+            return 0;
+        }
+        wait_until(&q_t->not_empty, queue_readable, NULL);
+    }
+
+    uint64_t n = head - tail;
+    if (n > (uint64_t)max) n = max;
+    for (uint64_t k = 0; k < n; k++) {
+        r->msg[k] = ring_slot(tail + k);
+        r->len[k] = strnlen(r->msg[k], BUFFER_SIZE - 1);
+    }
+    r->pos = tail;
+    r->end = tail + n;
+    r->n = n;
+    return n;
+}
+
+//claim a QUEUE_BCAST cursor starting at the retention floor, so a consumer sees every message
+//still held in the ring and everything published after it
+static void bcast_register(){
+    sem_wait(mutex);
+    for (int i = 0; i < MAX_CURSORS; i++) {
+        if (!atomic_load(&q_t->cursors[i].active)) {
+            atomic_store(&q_t->cursors[i].pos, atomic_load(&q_t->tail));
+            atomic_store(&q_t->cursors[i].owner, getpid());
+            atomic_store(&q_t->cursors[i].active, 1);
+            my_cursor = i;
+            break;
+        }
+    }
+    sem_post(mutex);
+    if (my_cursor < 0) {
+        fprintf(stderr, "Error: all %d broadcast consumer cursors are in use\n", MAX_CURSORS);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void bcast_unregister(){
+    atomic_store(&q_t->cursors[my_cursor].active, 0);
+    my_cursor = -1;
+    // the producer may be waiting on this consumer alone
+    waitword_notify(&q_t->not_full);
+}
+
+//QUEUE_BCAST peek: everything between this consumer's cursor and head, read in place
+static int bcast_peek(run_t *r, int max){
+    uint64_t pos = atomic_load_explicit(&q_t->cursors[my_cursor].pos, memory_order_relaxed);
+    uint64_t head;
+    while ((head = atomic_load_explicit(&q_t->head, memory_order_acquire)) == pos) {
+        if (queue_done() && atomic_load_explicit(&q_t->head, memory_order_acquire) == pos) {
+            return 0;
+        }
+        wait_until(&q_t->not_empty, queue_readable, NULL);
+    }
+
+    uint64_t n = head - pos;
+    if (n > (uint64_t)max) n = max;
+    for (uint64_t k = 0; k < n; k++) {
+        r->msg[k] = ring_slot(pos + k);
+        r->len[k] = strnlen(r->msg[k], BUFFER_SIZE - 1);
+    }
+    r->pos = pos;
+    r->end = pos + n;
+    r->n = n;
+    return n;
+}
+
+//QUEUE_SPSC release: one release store of tail frees the whole run
+static void spsc_release(run_t *r){
+    atomic_store_explicit(&q_t->tail, r->end, memory_order_release);
+}
+
+//wake-up condition for a QUEUE_MPMC producer stuck at head *arg: the slot there has been
+//released for this lap, or another producer has moved head past it. tail alone is not enough,
+//since a consumer advances it when it claims a run but frees the slots only after processing
+static bool mpmc_slot_free(void *arg){
+    uint64_t pos = *(uint64_t *)arg;
+    return (int64_t)(atomic_load_explicit(&mpmc_slot(pos)->seq, memory_order_acquire) - pos) >= 0 ||
+           atomic_load_explicit(&q_t->head, memory_order_relaxed) != pos;
+}
+
+//QUEUE_MPMC reserve: a run of slots whose sequence numbers show them free for this lap is
+//claimed by one CAS on head
+static int mpmc_reserve(run_t *r, int want){
+    uint64_t pos = atomic_load_explicit(&q_t->head, memory_order_relaxed);
+    uint64_t n;
+    while (1) {
+        n = 0;
+        while (n < (uint64_t)want &&
+               atomic_load_explicit(&mpmc_slot(pos + n)->seq, memory_order_acquire) == pos + n) {
+            n++;
+        }
+        if (n > 0) {
+            if (atomic_compare_exchange_weak_explicit(&q_t->head, &pos, pos + n,
+                    memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+            continue;
+        }
+
+        int64_t diff = (int64_t)(atomic_load_explicit(&mpmc_slot(pos)->seq, memory_order_acquire) - pos);
+        if (diff < 0) {
+            // The slot still holds the message from the previous lap: queue is full
+            if (q_t->policy == POLICY_DROP) {
+                return reserve_none(r, pos);
+            }
+            wait_until(&q_t->not_full, mpmc_slot_free, &pos);
+        }
+        // Otherwise another producer claimed pos first
+        pos = atomic_load_explicit(&q_t->head, memory_order_relaxed);
+    }
+
+    for (uint64_t k = 0; k < n; k++) {
+        r->msg[k] = mpmc_slot(pos + k)->data;
+        r->len[k] = sizeof(((slot_t *)0)->data);
+    }
+    r->pos = pos;
+    r->end = pos + n;
+    r->n = n;
+    return n;
+}
+
+//QUEUE_MPMC commit: each slot is handed to consumers by storing seq = pos + 1
+static void mpmc_commit(run_t *r){
+    for (int k = 0; k < r->n; k++) {
+        atomic_store_explicit(&mpmc_slot(r->pos + k)->seq, r->pos + k + 1, memory_order_release);
+    }
+}
+
+//QUEUE_MPMC peek: a run of filled slots at tail is claimed by one CAS, so no other consumer
+//can see them while they are processed in place. Without block it returns 0 as soon as
+//nothing is published, which lets -D workers move on to steal from another shard
+static int mpmc_peek(run_t *r, int max, bool block){
+    while (1) {
+        uint64_t pos = atomic_load_explicit(&q_t->tail, memory_order_relaxed);
+        uint64_t n = 0;
+        while (n < (uint64_t)max &&
+               atomic_load_explicit(&mpmc_slot(pos + n)->seq, memory_order_acquire) == pos + n + 1) {
+            n++;
+        }
+
+        if (n == 0) {
+            int64_t diff = (int64_t)(atomic_load_explicit(&mpmc_slot(pos)->seq, memory_order_acquire) - (pos + 1));
+            if (diff > 0) {
+                // Another consumer took this slot
+                continue;
+            }
+            // Nothing published at tail yet
+            bool claimed = atomic_load_explicit(&q_t->head, memory_order_acquire) != pos;
+            if (!block) {
+                return 0;
+            } else if (claimed) {
+                // A producer owns the slot and is still copying into it
+                sched_yield();
+            } else if (queue_done()) {
+                return 0;
+            } else {
+                wait_until(&q_t->not_empty, queue_readable, NULL);
+            }
+            continue;
+        }
+        if (!atomic_compare_exchange_weak_explicit(&q_t->tail, &pos, pos + n,
+                memory_order_relaxed, memory_order_relaxed)) {
+            // Another consumer took some of these slots
+            continue;
+        }
+
+        for (uint64_t k = 0; k < n; k++) {
+            r->msg[k] = mpmc_slot(pos + k)->data;
+            r->len[k] = strnlen(r->msg[k], sizeof(((slot_t *)0)->data) - 1);
+        }
+        r->pos = pos;
+        r->end = pos + n;
+        r->n = n;
+        return n;
+    }
+}
+
+//QUEUE_MPMC release: each slot is freed for the next lap by storing seq = pos + q_size
+static void mpmc_release(run_t *r){
+    for (int k = 0; k < r->n; k++) {
+        atomic_store_explicit(&mpmc_slot(r->pos + k)->seq, r->pos + k + q_t->q_size, memory_order_release);
+    }
+}
+
+//QUEUE_BYTES reserve: records of len bytes (lens[k] bytes each if lens is given) are laid out
+//after head while they fit, with a RECORD_PAD marker in front of one that would straddle the
+//end of the ring. A record over half the ring can need more than the whole ring together with
+//its pad; that pad is published on its own first, so the record then waits for room at 0
+static int bytes_reserve(run_t *r, int want, size_t len, const uint32_t *lens){
+    uint64_t ring = q_t->ring_bytes;
+    uint64_t head = atomic_load_explicit(&q_t->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&q_t->tail, memory_order_acquire);
+
+    r->pos = head;
+    r->n = 0;
+    while (r->n < want) {
+        if (lens != NULL) {
+            len = lens[r->n];
+        }
+        uint64_t rec = record_size(len);
+        if (rec > ring) {
+            fprintf(stderr, "Error: %zu byte message does not fit in a %lu byte ring\n",
+                    len, (unsigned long)ring);
+            exit(EXIT_FAILURE);
+        }
+        uint64_t pos = head % ring;
+        uint64_t pad = (ring - pos < rec) ? ring - pos : 0;
+        uint64_t need = pad + rec;
+        if (need > ring) {
+            if (r->n > 0) {
+                break; // the records before it go out first
+            }
+            if (head + pad - tail > ring) {
+                if (q_t->policy == POLICY_DROP) {
+                    return reserve_none(r, head);
+                }
+                journal_flush();
+                wait_until(&q_t->not_full, ring_has_room, &pad);
+                tail = atomic_load_explicit(&q_t->tail, memory_order_acquire);
+                continue;
+            }
+            ((record_t *)&q_t->messages[pos])->len = RECORD_PAD;
+            head += pad;
+            atomic_store_explicit(&q_t->head, head, memory_order_release);
+            waitword_notify(&q_t->not_empty);
+            r->pos = head;
+            continue;
+        }
+        if (head + need - tail > ring) {
+            if (r->n > 0 || q_t->policy == POLICY_DROP) {
+                break; // hand out what fits rather than waiting
+            }
+            journal_flush();
+            wait_until(&q_t->not_full, ring_has_room, &need);
+            tail = atomic_load_explicit(&q_t->tail, memory_order_acquire);
+            continue;
+        }
+
+        if (pad) {
+            ((record_t *)&q_t->messages[pos])->len = RECORD_PAD;
+            pos = 0;
+        }
+        record_t *hdr = (record_t *)&q_t->messages[pos];
+        hdr->len = len;
+        r->msg[r->n] = (char *)(hdr + 1);
+        r->len[r->n] = len;
+        r->n++;
+        head += need;
+    }
+    r->end = head;
+    return r->n;
+}
+
+//QUEUE_BYTES peek: walks records from tail up to the published head, skipping pad markers
+static int bytes_peek(run_t *r, int max){
+    uint64_t ring = q_t->ring_bytes;
+    uint64_t tail = atomic_load_explicit(&q_t->tail, memory_order_relaxed);
+
+    while (1) {
+        uint64_t head = readable_head();
+        if (tail == head) {
+            if (queue_done() && readable_head() == tail) {
+                return 0;
+            }
+            wait_until(&q_t->not_empty, queue_readable, NULL);
+            tail = atomic_load_explicit(&q_t->tail, memory_order_relaxed);
+            continue;
+        }
+
+        r->pos = tail;
+        r->n = 0;
+        while (tail != head && r->n < max) {
+            uint64_t pos = tail % ring;
+            record_t *hdr = (record_t *)&q_t->messages[pos];
+            if (hdr->len == RECORD_PAD) {
+                tail += ring - pos;
+                continue;
+            }
+            r->msg[r->n] = (char *)(hdr + 1);
+            r->len[r->n] = hdr->len;
+            r->n++;
+            tail += record_size(hdr->len);
+        }
+        r->end = tail;
+        if (r->n > 0) {
+            return r->n;
+        }
+        // Only pad markers were published; free them, waking a producer that may be waiting
+        // for that space, and look again
+        atomic_store_explicit(&q_t->tail, tail, memory_order_release);
+        waitword_notify(&q_t->not_full);
+    }
+}
+
+//POLICY_OVERWRITE reserve (QUEUE_SPSC only): never waits. The next slots are claimed whether
+//or not the consumer has read them; each one's seq is made odd before it is rewritten so a
+//consumer copying it out can tell, and the unread messages lapped over are counted
+static int lossy_reserve(run_t *r, int want){
+    uint64_t size = q_t->q_size;
+    uint64_t head = atomic_load_explicit(&q_t->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&q_t->tail, memory_order_acquire);
+    uint64_t n = ((uint64_t)want < size) ? (uint64_t)want : size;
+    if (head + n - tail > size) {
+        uint64_t lapped = head + n - tail - size;
+        if (lapped > n) lapped = n;
+        loss_stats.overwritten += lapped;
+        atomic_fetch_add_explicit(&q_t->stats.overwritten, lapped, memory_order_relaxed);
+    }
+
+    for (uint64_t k = 0; k < n; k++) {
+        atomic_store_explicit(&mpmc_slot(head + k)->seq, 2 * (head + k) + 1, memory_order_relaxed);
+    }
+    // the odd seqs must be visible before any of the new message bytes
+    atomic_thread_fence(memory_order_release);
+    for (uint64_t k = 0; k < n; k++) {
+        r->msg[k] = mpmc_slot(head + k)->data;
+        r->len[k] = sizeof(((slot_t *)0)->data);
+    }
+    r->pos = head;
+    r->end = head + n;
+    r->n = n;
+    return n;
+}
+
+//POLICY_OVERWRITE commit: seal each slot with its even seq, then publish head
+static void lossy_commit(run_t *r){
+    for (int k = 0; k < r->n; k++) {
+        atomic_store_explicit(&mpmc_slot(r->pos + k)->seq, 2 * (r->pos + k) + 2, memory_order_release);
+    }
+    atomic_store_explicit(&q_t->head, r->end, memory_order_release);
+}
+
+//POLICY_OVERWRITE peek: the producer may rewrite a slot at any moment, so messages are copied
+//out and kept only if the slot's seq was the one for their position before and after the copy.
+//A consumer lapped by more than q_size skips to the oldest slot that can still be intact, and
+//every position skipped or found rewritten is counted in r->lost
+static int lossy_peek(run_t *r, int max){
+    static char copies[MAX_BATCH][sizeof(((slot_t *)0)->data)];
+    uint64_t size = q_t->q_size;
+    uint64_t pos = atomic_load_explicit(&q_t->tail, memory_order_relaxed);
+    uint64_t lost = 0;
+
+    while (1) {
+        uint64_t head = readable_head();
+        if (head == pos) {
+            if (queue_done() && readable_head() == pos) {
+                r->n = 0;
+                break;
+            }
+            wait_until(&q_t->not_empty, queue_readable, NULL);
+            continue;
+        }
+        if (head - pos > size) {
+            lost += head - size - pos;
+            pos = head - size;
+        }
+
+        r->n = 0;
+        while (pos != head && r->n < max) {
+            slot_t *slot = mpmc_slot(pos);
+            uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+            if (seq != 2 * pos + 2) {
+                break;
+            }
+            memcpy(copies[r->n], slot->data, sizeof(slot->data));
+            atomic_thread_fence(memory_order_acquire);
+            if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) {
+                break;
+            }
+            copies[r->n][sizeof(slot->data) - 1] = '\0';
+            r->msg[r->n] = copies[r->n];
+            r->len[r->n] = strnlen(copies[r->n], sizeof(slot->data) - 1);
+            r->n++;
+            pos++;
+        }
+        if (r->n > 0) {
+            break;
+        }
+        // the slot at pos already belongs to a later lap, so its message is gone
+        lost++;
+        pos++;
+    }
+
+    r->end = pos;
+    r->pos = pos - r->n;
+    r->lost = lost;
+    if (lost > 0) {
+        loss_stats.gaps++;
+        loss_stats.lost += lost;
+        atomic_fetch_add_explicit(&q_t->stats.gaps, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&q_t->stats.lost, lost, memory_order_relaxed);
+    }
+    return r->n;
+}
+
+//producer side of the zero-copy API: reserve up to want message buffers at head, waiting with
+//the -w policy while the ring is full. r->msg[k] points into the segment and holds r->len[k]
+//bytes; len is the record size QUEUE_BYTES must lay out (lens[k] per record when lens is not
+//NULL) and is ignored by the slot modes
+static int queue_reserve(run_t *r, int want, size_t len, const uint32_t *lens){
+    if (want > MAX_BATCH) want = MAX_BATCH;
+    if (q_t->policy == POLICY_OVERWRITE) return lossy_reserve(r, want);
+    if (q_t->mode == QUEUE_SPSC) return spsc_reserve(r, want);
+    if (q_t->mode == QUEUE_MPMC) return mpmc_reserve(r, want);
+    if (q_t->mode == QUEUE_BCAST) return bcast_reserve(r, want);
+    return bytes_reserve(r, want, len, lens);
+}
+
+//publish a run filled in place since queue_reserve
+static void queue_commit(run_t *r){
+    if (q_t->policy == POLICY_OVERWRITE) {
+        lossy_commit(r);
+    } else if (q_t->mode == QUEUE_MPMC) {
+        mpmc_commit(r);
+    } else {
+        // spsc and bytes both publish by moving head to the end of the run
+        spsc_commit(r);
+    }
+    waitword_notify(&q_t->not_empty);
+    uint64_t occupancy = atomic_load_explicit(&q_t->head, memory_order_relaxed) -
+                         atomic_load_explicit(&q_t->tail, memory_order_relaxed);
+    if (q_t->policy == POLICY_OVERWRITE && occupancy > (uint64_t)q_t->q_size) {
+        occupancy = q_t->q_size;
+    }
+    stats_enqueued(r->n, run_bytes(r), occupancy);
+}
+
+//consumer side of the zero-copy API: up to max messages are returned in place in the segment
+//and stay valid until queue_release (POLICY_OVERWRITE hands out copies instead, since the
+//producer never waits for them). Returns 0 once producers are done and the ring is empty
+static int queue_peek(run_t *r, int max){
+    if (max > MAX_BATCH) max = MAX_BATCH;
+    r->lost = 0;
+    if (q_t->policy == POLICY_OVERWRITE) return lossy_peek(r, max);
+    if (q_t->mode == QUEUE_SPSC) return spsc_peek(r, max);
+    if (q_t->mode == QUEUE_MPMC) return mpmc_peek(r, max, true);
+    if (q_t->mode == QUEUE_BCAST) return bcast_peek(r, max);
+    return bytes_peek(r, max);
+}
+
+//hand the slots of a peeked run back to producers
+static void queue_release(run_t *r){
+    if (q_t->mode == QUEUE_MPMC) {
+        mpmc_release(r);
+    } else if (q_t->mode == QUEUE_BCAST) {
+        // only this consumer's cursor moves; the slots stay until every cursor passes them
+        atomic_store_explicit(&q_t->cursors[my_cursor].pos, r->end, memory_order_release);
+    } else {
+        spsc_release(r);
+    }
+    waitword_notify(&q_t->not_full);
+    stats_dequeued(r->n, run_bytes(r));
+}
+
+//the flag that makes the queue at q_t single-writer, for the attach errors
+static const char *queue_flag(){
+    if (q_t->policy == POLICY_OVERWRITE) {
+        return "-O overwrite";
+    }
+    if (q_t->mode == QUEUE_BCAST) {
+        return "-M bcast";
+    }
+    return q_t->mode == QUEUE_BYTES ? "-M bytes" : "-M spsc";
+}
+
+//QUEUE_SPSC, QUEUE_BYTES, QUEUE_BCAST and POLICY_OVERWRITE publish head with a plain store,
+//so they take one producer at a time
+static bool single_producer(){
+    return q_t->mode == QUEUE_SPSC || q_t->mode == QUEUE_BYTES || q_t->mode == QUEUE_BCAST ||
+           q_t->policy == POLICY_OVERWRITE;
+}
+
+//QUEUE_SPSC and QUEUE_BYTES also move tail with a plain store, so they take one consumer at a
+//time
+static bool single_consumer(){
+    return q_t->mode == QUEUE_SPSC || q_t->mode == QUEUE_BYTES;
+}
+
+//join the lock-free queue at q_t as a producer; done only means "no more messages" once
+//every attached producer has finished. A single_producer queue only lets the first producer
+//attach, and refuses the rest until it detaches
+static void producer_attach(){
+    if (single_producer()) {
+        int none = 0;
+        if (!atomic_compare_exchange_strong(&q_t->producers, &none, 1)) {
+            fprintf(stderr, "Error: %s queue already has a producer and takes only one\n", queue_flag());
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        atomic_fetch_add(&q_t->producers, 1);
+    }
+    atomic_store(&q_t->done, 0);
+}
+
+//join the segment at q_t as a consumer; while any consumer is attached no producer restarts
+//the queue under it. A single_consumer queue refuses a second consumer the same way
+static void consumer_attach(){
+    if (single_consumer()) {
+        int none = 0;
+        if (!atomic_compare_exchange_strong(&q_t->consumers, &none, 1)) {
+            fprintf(stderr, "Error: %s queue already has a consumer and takes only one\n", queue_flag());
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        atomic_fetch_add(&q_t->consumers, 1);
+    }
+}
+
+//leave the segment at q_t; true for the last consumer out when no producer is attached either,
+//which is then the one to remove the segment
+static bool consumer_detach(){
+    sem_wait(mutex);
+    bool last = atomic_fetch_sub(&q_t->consumers, 1) == 1 && atomic_load(&q_t->producers) == 0;
+    sem_post(mutex);
+    return last;
+}
+
+//remove a channel's segment once its last user has left
+static void remove_segment(const channel_names_t *n){
+    if (journal_path != NULL) {
+        // the journal outlives its users; that is the point of it
+    } else if (huge_pages) {
+        unlink(n->huge);
+    } else {
+        shm_unlink(n->shm);
+    }
+}
+
+static void producer_detach(){
+    atomic_fetch_add(&q_t->finished, 1);
+    if (atomic_fetch_sub(&q_t->producers, 1) == 1) {
+        atomic_store_explicit(&q_t->done, 1, memory_order_release);
+        waitword_notify(&q_t->not_empty);
+    }
+}
+
+//reserve, fill and commit up to want copies of m on the lock-free queue at q_t
+static int produce_run(const char *m, size_t len, int want, bool e){
+    run_t r;
+    if (queue_reserve(&r, want, len, NULL) == 0) {
+        // POLICY_DROP: the ring is full, so the new messages are discarded instead of waited for
+        loss_stats.dropped += want;
+        atomic_fetch_add_explicit(&q_t->stats.dropped, want, memory_order_relaxed);
+        return want;
+    }
+    // written straight into the reserved slots; byte-ring records carry their length
+    for (int k = 0; k < r.n; k++) {
+        if (q_t->mode == QUEUE_BYTES) {
+            memcpy(r.msg[k], m, len);
+        } else {
+            copy_message(r.msg[k], m, r.len[k]);
+            // from here on len is the message length, which is what the stats count
+            r.len[k] = strnlen(m, r.len[k] - 1);
+        }
+        if (bench_mode) {
+            stamp_message(r.msg[k]);
+        }
+    }
+    queue_commit(&r);
+    journal_progress(r.n, true);
+    for (int k = 0; k < r.n && e; k++) 
+    {
+        printf("Message from Producer: %s\n", m);
+    }
+    return r.n;
+}
+
+//function for producer in shared memory, iterates through queue size and produces messages 
+void producer_shared(const char *m, int q, bool e){
+    if (q_t->mode != QUEUE_SEM) {
+        producer_attach();
+        size_t len = strlen(m);
+        for(int i = 0; i < q; ){
+            i += produce_run(m, len, (q - i < batch_size) ? q - i : batch_size, e);
+        }
+        if (journal_path != NULL) {
+            // everything is durable before consumers are told there is no more
+            journal_sync(true);
+            printf("Journal: %lu group commits\n", journal_syncs);
+        }
+        producer_detach();
+        return;
+    }
+    for(int i = 0; i < q; i++){
+        bool dropped = false;
+        while (sem_trywait(empty) != 0) {
+            if (q_t->policy == POLICY_DROP) {
+                dropped = true;
+                break;
+            }
+            wait_until(&q_t->not_full, queue_writable, NULL);
+        }
+        if (dropped) {
+            loss_stats.dropped++;
+            atomic_fetch_add_explicit(&q_t->stats.dropped, 1, memory_order_relaxed);
+            continue;
+        }
+        sem_wait(mutex);
+
+        copy_message(&q_t->messages[q_t->head * BUFFER_SIZE], m, BUFFER_SIZE);
+        if (bench_mode) {
+            stamp_message(&q_t->messages[q_t->head * BUFFER_SIZE]);
+        }
+        q_t->head = (q_t->head +1) % q_t->q_size;
+        if (e) 
+        {
+            printf("Message from Producer: %s\n", m);
+        }
         sem_post(mutex);
         sem_post(full);
+        waitword_notify(&q_t->not_empty);
+        int full_val;
+        sem_getvalue(full, &full_val);
+        stats_enqueued(1, strnlen(m, BUFFER_SIZE - 1), full_val);
 
     }
     sem_wait(mutex);
+    q_t->finished++;
     q_t->done = 1;
     sem_post(mutex);
+    waitword_notify(&q_t->not_empty);
+}
+
+//-i on the lock-free queue: each batch of up to -b buffered records is copied into reserved
+//runs, since the ring may hand out fewer slots than asked for. Slot modes carry text records
+//that fit a slot, QUEUE_BYTES any bytes up to the ring size
+void producer_records(bool e){
+    size_t cap = (q_t->mode == QUEUE_BYTES) ? SIZE_MAX : sizeof(((slot_t *)0)->data) - 1;
+    const char *p[MAX_BATCH];
+    uint32_t lens[MAX_BATCH];
+    src_t src;
+    src_open(&src, input_path);
+    uint64_t start = now_ns();
+    producer_attach();
+
+    while (1) {
+        int n = 0;
+        while (n < batch_size && src_next(&src, &p[n], &lens[n])) {
+            if (lens[n] > cap) {
+                fprintf(stderr, "Error: %u byte record does not fit a %zu byte slot; use -M bytes\n",
+                        lens[n], cap);
+                exit(EXIT_FAILURE);
+            }
+            n++;
+        }
+        for (int i = 0; i < n; ) {
+            run_t r;
+            if (queue_reserve(&r, n - i, 0, &lens[i]) == 0) {
+                // POLICY_DROP: the ring is full, so the rest of the batch is discarded
+                loss_stats.dropped += n - i;
+                atomic_fetch_add_explicit(&q_t->stats.dropped, n - i, memory_order_relaxed);
+                break;
+            }
+            for (int k = 0; k < r.n; k++) {
+                memcpy(r.msg[k], p[i + k], lens[i + k]);
+                if (q_t->mode != QUEUE_BYTES) {
+                    r.msg[k][lens[i + k]] = '\0';
+                }
+                r.len[k] = lens[i + k];
+                if (e) {
+                    printf("Message from Producer: %.*s\n", (int)lens[i + k], p[i + k]);
+                }
+            }
+            queue_commit(&r);
+            journal_progress(r.n, true);
+            i += r.n;
+        }
+        if (n < batch_size && !src.eof) {
+            // the read may block on a pipe
+            journal_flush();
+        }
+        if (n < batch_size && !src_refill(&src)) {
+            break;
+        }
+    }
+    if (journal_path != NULL) {
+        journal_sync(true);
+    }
+    producer_detach();
+    src_close(&src, start);
 }
 
 //function for consumer in shared memory, continuously consumes messages
 void consumer_shared(int q, bool e){
     printf("Consumer started. Waiting for messages.\n");
+    fflush(stdout);
+    if (q_t->mode != QUEUE_SEM) {
+        // messages are processed where the producer wrote them and freed afterwards
+        run_t r;
+        if (q_t->mode == QUEUE_BCAST) {
+            bcast_register();
+        }
+        while (queue_peek(&r, batch_size) > 0) {
+            if (r.lost > 0 && e) {
+                printf("Consumer detected gap: %lu messages overwritten before message %lu\n",
+                       (unsigned long)r.lost, (unsigned long)r.pos);
+            }
+            for (int k = 0; k < r.n; k++) 
+            {
+                bench_record(r.msg[k], r.len[k]);
+                if (output_mode) {
+                    out_record(r.msg[k], r.len[k]);
+                }
+                if (e) {
+                    printf("Consumer Received: %.*s\n", (int)r.len[k], r.msg[k]);
+                }
+            }
+            // the records are written from the ring, so before their slots go back
+            if (output_mode) {
+                out_flush();
+            }
+            queue_release(&r);
+            journal_progress(r.n, false);
+        }
+        if (q_t->mode == QUEUE_BCAST) {
+            bcast_unregister();
+        }
+        if (journal_path != NULL) {
+            journal_sync(false);
+            printf("Journal: %lu cursor commits\n", journal_syncs);
+        }
+        printf("All messages consumed. Exiting.\n");
+        return;
+    }
     
     while(1){
-        // Check if producer is done and queue is empty
-        sem_wait(mutex);
-        int done = q_t->done;
-        int full_val;
-        sem_getvalue(full, &full_val);
-        sem_post(mutex);
-        
-        if (done && full_val == 0) {
+        // Try to get a message without blocking
+        if (sem_trywait(full) == 0) {
+            // Successfully got a message, read it in place while holding the mutex
+            sem_wait(mutex);
+            const char *m = &q_t->messages[q_t->tail * BUFFER_SIZE];
+            bench_record(m, strlen(m));
+            if (output_mode) {
+                out_record(m, strlen(m));
+                out_flush();
+            }
+            stats_dequeued(1, strlen(m));
+            if (e) 
+            {
+                printf("Consumer Received: %s\n", m);
+            }
+            q_t->tail = (q_t->tail + 1) % q_t->q_size;
+            sem_post(mutex);
+            sem_post(empty);
+            waitword_notify(&q_t->not_full);
+        } else if (queue_done()) {
+            // done is set after the producer's last post, so recheck before leaving
+            int full_val;
+            sem_getvalue(full, &full_val);
+            if (full_val > 0) {
+                continue;
+            }
             printf("All messages consumed. Exiting.\n");
             break;
+        } else {
+            // No message available now, wait for a producer to post one
+            wait_until(&q_t->not_empty, queue_readable, NULL);
+        }
+    }
+}
+
+//-D sharded queues: shard i is the MPMC channel "<topic>_shard<i>", drained by a pool of
+//worker threads that each own one shard and steal from the others when theirs is empty
+typedef struct{
+    queue_t *q;
+    size_t size;
+    channel_names_t names;
+}shard_t;
+
+typedef struct{
+    pthread_t thread;
+    int id;
+    bool e;
+    unsigned long consumed;
+    unsigned long stolen;
+    wait_stats_t waits;
+    bench_t bench;
+    bench_t *live;
+}worker_t;
+
+//-D -j: the workers' histograms are thread-local, so the main thread takes SIGUSR1 and reports
+//their sum. live points at a running worker's histogram and is cleared, under workers_lock,
+//once the final copy is in bench; workers_left counts the workers still running
+pthread_mutex_t workers_lock = PTHREAD_MUTEX_INITIALIZER;
+_Atomic int workers_left;
+
+shard_t *shards;
+int shard_count = 0;
+//-T: consumer worker threads, at least one per shard
+int worker_count = 0;
+
+//map every shard of the selected channel, creating the ones that do not exist yet
+void attach_shards(int q, size_t ring_bytes){
+    channel_names_t base = names;
+    shards = calloc(shard_count, sizeof(shard_t));
+    if (shards == NULL) {
+        perror("calloc failed");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < shard_count; i++) {
+        char topic[CHANNEL_NAME * 2];
+        snprintf(topic, sizeof(topic), "%s%sshard%d", base.topic, base.topic[0] ? "_" : "", i);
+        channel_names(topic, &names);
+        create_sharedmem(q, QUEUE_MPMC, ring_bytes);
+        shards[i].q = q_t;
+        shards[i].size = shm_size;
+        shards[i].names = names;
+    }
+    names = base;
+    q_t = NULL;
+}
+
+//unmap every shard; the last consumer to leave a shard removes it, as cleanup does for a
+//single segment
+void detach_shards(bool consumer){
+    for (int i = 0; i < shard_count; i++) {
+        q_t = shards[i].q;
+        bool last = consumer && consumer_detach();
+        munmap(shards[i].q, shards[i].size);
+        if (last) {
+            remove_segment(&shards[i].names);
+        }
+    }
+    q_t = NULL;
+    free(shards);
+}
+
+//sharded producer: runs of -b messages go round-robin over the shards, starting from a shard
+//picked by hashing the pid so concurrent producers spread out
+void producer_sharded(const char *m, int q, bool e){
+    for (int s = 0; s < shard_count; s++) {
+        q_t = shards[s].q;
+        producer_attach();
+    }
+    size_t len = strlen(m);
+    int s = getpid() % shard_count;
+    for (int i = 0; i < q; s = (s + 1) % shard_count) {
+        q_t = shards[s].q;
+        i += produce_run(m, len, (q - i < batch_size) ? q - i : batch_size, e);
+    }
+    for (int s = 0; s < shard_count; s++) {
+        q_t = shards[s].q;
+        producer_detach();
+    }
+    // workers parked on a shard that finished earlier wait for all of them; wake them now
+    for (int s = 0; s < shard_count; s++) {
+        waitword_notify(&shards[s].q->not_empty);
+    }
+}
+
+//every shard finished by its producers and drained
+static bool shards_done(){
+    for (int s = 0; s < shard_count; s++) {
+        q_t = shards[s].q;
+        if (!queue_done() ||
+            atomic_load_explicit(&q_t->head, memory_order_acquire) !=
+            atomic_load_explicit(&q_t->tail, memory_order_acquire)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+//wake-up condition for a worker parked on its home shard: a message on any shard, or every
+//shard finished. queue_readable would hold as soon as the home shard alone was done, and a
+//worker whose shard finished early would spin until the rest did
+static bool shards_readable(void *arg){
+    queue_t *home = arg;
+    bool ready = true;
+    for (int s = 0; s < shard_count; s++) {
+        q_t = shards[s].q;
+        if (atomic_load_explicit(&q_t->head, memory_order_acquire) !=
+            atomic_load_explicit(&q_t->tail, memory_order_acquire)) {
+            ready = true;
+            break;
+        }
+        if (!queue_done()) {
+            ready = false;
+        }
+    }
+    q_t = home;
+    return ready;
+}
+
+//worker thread: drain the home shard, steal from the others in turn once it is empty, and
+//park on the home shard when all of them are
+static void *shard_worker(void *arg){
+    worker_t *w = arg;
+    int home = w->id % shard_count;
+    pthread_mutex_lock(&workers_lock);
+    w->live = &bench;
+    pthread_mutex_unlock(&workers_lock);
+    run_t *r = malloc(sizeof(run_t));
+    if (r == NULL) {
+        perror("malloc failed");
+        exit(EXIT_FAILURE);
+    }
+    while (1) {
+        int got = 0;
+        for (int k = 0; k < shard_count && got == 0; k++) {
+            q_t = shards[(home + k) % shard_count].q;
+            got = mpmc_peek(r, batch_size, false);
+            if (got == 0) {
+                continue;
+            }
+            for (int i = 0; i < r->n; i++) {
+                bench_record(r->msg[i], r->len[i]);
+                if (w->e) {
+                    printf("Worker %d Received: %.*s\n", w->id, (int)r->len[i], r->msg[i]);
+                }
+            }
+            queue_release(r);
+            w->consumed += got;
+            if (k > 0) {
+                w->stolen += got;
+            }
+        }
+        if (got > 0) {
+            continue;
+        }
+        if (shards_done()) {
+            break;
         }
-        
-        // Try to get a message without blocking
-        if (sem_trywait(full) == 0) {
-            // Successfully got a message
-            sem_wait(mutex);
-            char m[BUFFER_SIZE];
+        q_t = shards[home].q;
+        wait_until(&q_t->not_empty, shards_readable, q_t);
+    }
+    free(r);
+    w->waits = wait_stats;
+    pthread_mutex_lock(&workers_lock);
+    w->bench = bench;
+    w->live = NULL;
+    pthread_mutex_unlock(&workers_lock);
+    atomic_fetch_sub(&workers_left, 1);
+    return NULL;
+}
 
-            strncpy(m, &q_t->messages[q_t->tail * BUFFER_SIZE], BUFFER_SIZE - 1);
+//SIGUSR1 under -D: report the pool's samples so far. The running workers keep counting while
+//they are summed, so this is a snapshot rather than an exact cut
+static void sharded_report(worker_t *workers){
+    pthread_mutex_lock(&workers_lock);
+    for (int i = 0; i < worker_count; i++) {
+        bench_merge(workers[i].live != NULL ? workers[i].live : &workers[i].bench);
+    }
+    pthread_mutex_unlock(&workers_lock);
+    bench_report();
+    memset(&bench, 0, sizeof(bench));
+}
 
-            m[BUFFER_SIZE - 1] = '\0';
-            q_t->tail = (q_t->tail + 1) % q_t->q_size;
-            if (e) 
-            {
-                printf("Consumer Received: %s\n", m);
-            }
-            sem_post(mutex);
-            sem_post(empty);
-        } else {
-            // No message available now, wait a bit before checking again
-            usleep(100000); // 100ms
+//consumer for -D: start the worker pool and wait for every shard to be drained
+void consumer_sharded(bool e){
+    printf("Consumer started with %d workers on %d shards. Waiting for messages.\n", worker_count, shard_count);
+    fflush(stdout);
+    for (int s = 0; s < shard_count; s++) {
+        q_t = shards[s].q;
+        consumer_attach();
+    }
+    worker_t *workers = calloc(worker_count, sizeof(worker_t));
+    if (workers == NULL) {
+        perror("calloc failed");
+        exit(EXIT_FAILURE);
+    }
+    // the workers inherit SIGUSR1 blocked, so only the sigtimedwait below ever takes it
+    sigset_t usr1;
+    sigemptyset(&usr1);
+    sigaddset(&usr1, SIGUSR1);
+    if (bench_mode) {
+        pthread_sigmask(SIG_BLOCK, &usr1, NULL);
+    }
+    atomic_store(&workers_left, worker_count);
+    for (int i = 0; i < worker_count; i++) {
+        workers[i].id = i;
+        workers[i].e = e;
+        if (pthread_create(&workers[i].thread, NULL, shard_worker, &workers[i]) != 0) {
+            perror("pthread_create failed");
+            exit(EXIT_FAILURE);
+        }
+    }
+    struct timespec report_check = {0, REPORT_CHECK_MS * 1000000L};
+    while (bench_mode && atomic_load(&workers_left) > 0) {
+        if (sigtimedwait(&usr1, NULL, &report_check) == SIGUSR1) {
+            sharded_report(workers);
         }
     }
+    unsigned long total = 0;
+    for (int i = 0; i < worker_count; i++) {
+        pthread_join(workers[i].thread, NULL);
+        printf("Worker %d: %lu messages, %lu stolen\n", i, workers[i].consumed, workers[i].stolen);
+        total += workers[i].consumed;
+        wait_stats.waits += workers[i].waits.waits;
+        wait_stats.spins += workers[i].waits.spins;
+        wait_stats.yields += workers[i].waits.yields;
+        wait_stats.parks += workers[i].waits.parks;
+        bench_merge(&workers[i].bench);
+    }
+    printf("All messages consumed (%lu total). Exiting.\n", total);
+    free(workers);
 }
 
 //function to cleanup semaphores after program runs 
 void cleanup(){
     // Check if q_t is initialized (only happens in shared memory mode)
     if (q_t != NULL) {
-        sem_wait(mutex);
-        q_t->count--;
-        int should_clean = (q_t->count == 0);
-        int q_size = q_t->q_size;  // Save q_size before unmapping
-        sem_post(mutex);
-
-        if (should_clean) {
+        if (consumer_detach()) {
             printf("Cleaning up shared memory resources.\n");
-            size_t total_size = sizeof(queue_t) + (q_size * BUFFER_SIZE);
-            munmap(q_t, total_size);
-            shm_unlink(SHM_NAME);
+            munmap(q_t, shm_size);
+            remove_segment(&names);
             
             // Also unlink semaphores since we're the last process
-            sem_unlink(SEM_FULL);
-            sem_unlink(SEM_EMPTY);
-            sem_unlink(SEM_MUTEX);
+            sem_unlink(names.full);
+            sem_unlink(names.empty);
+            sem_unlink(names.mutex);
         } else {
             // Just unmap our view of the shared memory
-            size_t total_size = sizeof(queue_t) + (q_size * BUFFER_SIZE);
-            munmap(q_t, total_size);
+            munmap(q_t, shm_size);
         }
         
         // Close the semaphores in any case
@@ -361,9 +3605,9 @@ void cleanup(){
         sem_close(full);
         sem_close(empty);
         sem_close(mutex);
-        sem_unlink(SEM_FULL);
-        sem_unlink(SEM_EMPTY);
-        sem_unlink(SEM_MUTEX);
+        sem_unlink(names.full);
+        sem_unlink(names.empty);
+        sem_unlink(names.mutex);
     }
 }
 
@@ -380,8 +3624,27 @@ int main(int argc, char *argv[]){
     bool e_arg = false;
     char c;
     int q_depth = 10; // default queue depth
-    char msg[BUFFER_SIZE] = {0};
-    while((c =getopt(argc, argv, "pcm:q:use")) != -1){
+    int q_mode = QUEUE_SEM;
+    bool mode_arg = false;
+    bool wait_arg = false;
+    bool policy_arg = false;
+    bool bytes_arg = false;
+    size_t ring_bytes = 0;
+    // points at argv so QUEUE_BYTES can carry messages longer than BUFFER_SIZE
+    const char *msg = "";
+    bool batch_arg = false;
+    bool epoll_arg = false;
+    bool uring_arg = false;
+    // -n decouples the number of messages sent from the queue depth
+    int msg_count = -1;
+    char *sized_msg = NULL;
+    const char *topic = "";
+    bool topic_arg = false;
+    bool list_arg = false;
+    bool shard_arg = false;
+    bool clock_arg = false;
+    int stats_interval = 0;
+    while((c =getopt(argc, argv, "pcm:q:useM:w:O:B:b:kFEUl:P:n:z:jY:Ht:LD:T:S:J:G:I:i:Ro")) != -1){
         switch(c){
             case 'p':
                 if(is_producer){
@@ -438,14 +3701,332 @@ int main(int argc, char *argv[]){
                 }
                 exist_msg = true;
 
-                strncpy(msg, optarg, BUFFER_SIZE - 1);
+                msg = optarg;
+                break;
+
+            case 'M':
+                if(mode_arg){
+                    fprintf(stderr, "Error: Multiple -M Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                mode_arg = true;
+                if(strcmp(optarg, "sem") == 0){
+                    q_mode = QUEUE_SEM;
+                }
+                else if(strcmp(optarg, "spsc") == 0){
+                    q_mode = QUEUE_SPSC;
+                }
+                else if(strcmp(optarg, "mpmc") == 0){
+                    q_mode = QUEUE_MPMC;
+                }
+                else if(strcmp(optarg, "bytes") == 0){
+                    q_mode = QUEUE_BYTES;
+                }
+                else if(strcmp(optarg, "bcast") == 0){
+                    q_mode = QUEUE_BCAST;
+                }
+                else{
+                    fprintf(stderr, "Error: -M must be sem, spsc, mpmc, bytes or bcast\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'w':
+                if(wait_arg){
+                    fprintf(stderr, "Error: Multiple -w Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                wait_arg = true;
+                wait_policy = -1;
+                for(int i = 0; i < 4; i++){
+                    if(strcmp(optarg, wait_policy_names[i]) == 0){
+                        wait_policy = i;
+                    }
+                }
+                if(wait_policy < 0){
+                    fprintf(stderr, "Error: -w must be spin, yield, park or block\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'O':
+                if(policy_arg){
+                    fprintf(stderr, "Error: Multiple -O Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                policy_arg = true;
+                overflow_policy = -1;
+                for(int i = 0; i < 3; i++){
+                    if(strcmp(optarg, overflow_policy_names[i]) == 0){
+                        overflow_policy = i;
+                    }
+                }
+                if(overflow_policy < 0){
+                    fprintf(stderr, "Error: -O must be block, drop or overwrite\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'k':
+                if(stream_mode){
+                    fprintf(stderr, "Error: Multiple -k Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                stream_mode = true;
+                break;
+
+            case 'F':
+                if(fd_mode){
+                    fprintf(stderr, "Error: Multiple -F Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                fd_mode = true;
+                break;
+
+            case 'U':
+                if(uring_arg){
+                    fprintf(stderr, "Error: Multiple -U Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                uring_arg = true;
+                break;
+
+            case 'E':
+                if(epoll_arg){
+                    fprintf(stderr, "Error: Multiple -E Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                epoll_arg = true;
+                break;
+
+            case 'l':
+                listen_backlog = atoi(optarg);
+                if(listen_backlog < 1){
+                    fprintf(stderr, "Error: -l backlog must be at least 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'P':
+                expected_producers = atoi(optarg);
+                if(expected_producers < 0){
+                    fprintf(stderr, "Error: -P producer count must not be negative\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'b':
+                if(batch_arg){
+                    fprintf(stderr, "Error: Multiple -b Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                batch_arg = true;
+                batch_size = atoi(optarg);
+                if(batch_size < 1 || batch_size > MAX_BATCH){
+                    fprintf(stderr, "Error: -b batch size must be between 1 and %d\n", MAX_BATCH);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'n':
+                if(msg_count >= 0){
+                    fprintf(stderr, "Error: Multiple -n Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                msg_count = atoi(optarg);
+                if(msg_count < 0){
+                    fprintf(stderr, "Error: -n message count must not be negative\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'z':
+                if(exist_msg){
+                    fprintf(stderr, "Error: Multiple -m/-z Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                exist_msg = true;
+                // a generated payload of the requested size stands in for -m
+                size_t size = strtoull(optarg, NULL, 10);
+                if(size < 1){
+                    fprintf(stderr, "Error: -z message size must be at least 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                sized_msg = malloc(size + 1);
+                if(sized_msg == NULL){
+                    perror("malloc failed");
+                    exit(EXIT_FAILURE);
+                }
+                memset(sized_msg, 'x', size);
+                sized_msg[size] = '\0';
+                msg = sized_msg;
+                break;
+
+            case 't':
+                if(topic_arg){
+                    fprintf(stderr, "Error: Multiple -t Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                topic_arg = true;
+                topic = optarg;
+                // the topic becomes part of shm, semaphore and socket names
+                if(strlen(topic) == 0 || strlen(topic) >= CHANNEL_NAME ||
+                   strspn(topic, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789_-") != strlen(topic)){
+                    fprintf(stderr, "Error: -t topic must be 1-%d letters, digits, '_' or '-'\n", CHANNEL_NAME - 1);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'L':
+                list_arg = true;
+                break;
+
+            case 'S':
+                if(stats_interval > 0){
+                    fprintf(stderr, "Error: Multiple -S Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                stats_interval = atoi(optarg);
+                if(stats_interval < 1){
+                    fprintf(stderr, "Error: -S interval must be at least 1 ms\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'D':
+                if(shard_arg){
+                    fprintf(stderr, "Error: Multiple -D Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                shard_arg = true;
+                // 0 asks for one shard per online core
+                shard_count = atoi(optarg);
+                if(shard_count == 0){
+                    shard_count = sysconf(_SC_NPROCESSORS_ONLN);
+                }
+                if(shard_count < 1 || shard_count > MAX_CHANNELS){
+                    fprintf(stderr, "Error: -D shard count must be between 1 and %d\n", MAX_CHANNELS);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'T':
+                worker_count = atoi(optarg);
+                if(worker_count < 1){
+                    fprintf(stderr, "Error: -T worker count must be at least 1\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'i':
+                if(exist_msg){
+                    fprintf(stderr, "Error: Multiple -m/-z/-i Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                exist_msg = true;
+                input_path = optarg;
+                break;
+
+            case 'R':
+                length_prefixed = true;
+                break;
+
+            case 'o':
+                if(output_mode){
+                    fprintf(stderr, "Error: Multiple -o Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                output_mode = true;
+                break;
+
+            case 'J':
+                if(journal_path != NULL){
+                    fprintf(stderr, "Error: Multiple -J Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                journal_path = optarg;
+                break;
+
+            case 'G':
+                group_messages = atoi(optarg);
+                if(group_messages < 1){
+                    fprintf(stderr, "Error: -G group commit must be at least 1 message\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'I':
+                group_us = atoi(optarg);
+                if(group_us < 1){
+                    fprintf(stderr, "Error: -I group commit interval must be at least 1 microsecond\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'H':
+                if(huge_pages){
+                    fprintf(stderr, "Error: Multiple -H Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                huge_pages = true;
+                break;
+
+            case 'j':
+                if(bench_mode){
+                    fprintf(stderr, "Error: Multiple -j Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                bench_mode = true;
+                break;
+
+            case 'Y':
+                if(clock_arg){
+                    fprintf(stderr, "Error: Multiple -Y Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                clock_arg = true;
+                if(strcmp(optarg, "mono") == 0){
+                    stamp_clock = CLOCK_MONO;
+                }
+                else if(strcmp(optarg, "tsc") == 0){
+                    stamp_clock = CLOCK_TSC;
+                }
+                else{
+                    fprintf(stderr, "Error: -Y must be mono or tsc\n");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'B':
+                if(bytes_arg){
+                    fprintf(stderr, "Error: Multiple -B Arguments Passed\n");
+                    exit(EXIT_FAILURE);
+                }
+                bytes_arg = true;
+                // records are RECORD_ALIGN aligned, so the ring must be too
+                ring_bytes = strtoull(optarg, NULL, 10) & ~(size_t)(RECORD_ALIGN - 1);
+                if(ring_bytes < 2 * sizeof(record_t)){
+                    fprintf(stderr, "Error: -B ring must be at least %zu bytes\n", 2 * sizeof(record_t));
+                    exit(EXIT_FAILURE);
+                }
                 break;
             default:
-                fprintf(stderr, "Usage: %s -p/-c -q <depth> -u/-s -e -m <message>\n ", argv[0]);
+                fprintf(stderr, "Usage: %s -p/-c -q <depth> -u/-s [-M sem|spsc|mpmc|bytes|bcast] [-B <ring bytes>] [-b <batch>] [-k|-F] [-E|-U [-P <connections>]] [-l <backlog>] [-w spin|yield|park|block] [-O block|drop|overwrite] [-H|-J <journal file> [-G <messages>] [-I <usec>]] [-t <topic>] [-L] [-S <interval ms> [-n <samples>]] [-D <shards> [-T <workers>]] [-n <messages>] [-j [-Y mono|tsc]] -e -m <message>|-z <size>|-i <file|-> [-R] [-o]\n ", argv[0]);
 
         }
     }
     
+    channel_names(topic, &names);
+    if (list_arg) {
+        list_channels();
+        return 0;
+    }
+    // the stats reader only maps the segment, it never opens or creates the semaphores
+    if (stats_interval > 0) {
+        stats_reader(stats_interval, msg_count > 0 ? msg_count : 0);
+        return 0;
+    }
+
     //error handling for aguments passed
     if ((is_producer && is_consumer) || (!is_producer && !is_consumer) ){
         fprintf(stderr, "Error: Missing -p or -c\n");
@@ -462,10 +4043,106 @@ int main(int argc, char *argv[]){
         exit(EXIT_FAILURE);
     }
     
+    if (msg_count < 0) {
+        msg_count = q_depth;
+    }
+    // shards are MPMC rings, since stealing puts several workers on one shard
+    if (shard_arg) {
+        if (!s_arg || (mode_arg && q_mode != QUEUE_MPMC)) {
+            fprintf(stderr, "Error: -D is only supported with -s and -M mpmc\n");
+            exit(EXIT_FAILURE);
+        }
+        q_mode = QUEUE_MPMC;
+        if (worker_count == 0) {
+            worker_count = shard_count;
+        }
+        if (worker_count < shard_count) {
+            // each shard needs a worker parked on it to be woken for new messages
+            fprintf(stderr, "Error: -T needs at least one worker per shard\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // back-pressure is a property of the shared ring; overwriting needs the single-producer
+    // slot ring, since a second producer could be rewriting the same slot a lap later
+    if (policy_arg && !s_arg) {
+        fprintf(stderr, "Error: -O is only supported with -s\n");
+        exit(EXIT_FAILURE);
+    }
+    if (overflow_policy == POLICY_OVERWRITE && (shard_arg || ((is_producer || queue_arg) && q_mode != QUEUE_SPSC))) {
+        fprintf(stderr, "Error: -O overwrite is only supported with -M spsc\n");
+        exit(EXIT_FAILURE);
+    }
+    // record streams: -i replaces -m on producers that can carry variable-length records, -o
+    // makes a consumer write them out again; stamps would overwrite the records' contents
+    if (input_path != NULL && (!is_producer || bench_mode || uring_arg || fd_mode || shard_arg ||
+                               (u_arg && !stream_mode) || (s_arg && q_mode == QUEUE_SEM))) {
+        fprintf(stderr, "Error: -i needs a producer with -u -k or -s with a lock-free -M mode, and excludes -j, -U, -F and -D\n");
+        exit(EXIT_FAILURE);
+    }
+    if (output_mode && (!is_consumer || shard_arg || (u_arg && !stream_mode))) {
+        fprintf(stderr, "Error: -o needs a consumer with -u -k or -s, and excludes -D\n");
+        exit(EXIT_FAILURE);
+    }
+    if (length_prefixed && input_path == NULL && !output_mode) {
+        fprintf(stderr, "Error: -R needs -i or -o\n");
+        exit(EXIT_FAILURE);
+    }
+    if ((input_path != NULL || output_mode) && !batch_arg) {
+        batch_size = STREAM_FRAMES;
+    }
+    if (output_mode) {
+        // records own stdout; everything else the consumer prints goes to stderr
+        out.fd = dup(STDOUT_FILENO);
+        dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    // a journal is only crash-consistent where head moves once a whole run has been written,
+    // so a producer dying mid-run leaves nothing half-claimed behind durable
+    if (journal_path != NULL) {
+        if (!s_arg || huge_pages || shard_arg) {
+            fprintf(stderr, "Error: -J is only supported with -s and without -H or -D\n");
+            exit(EXIT_FAILURE);
+        }
+        if ((is_producer || queue_arg) && q_mode != QUEUE_SPSC && q_mode != QUEUE_BYTES) {
+            fprintf(stderr, "Error: -J is only supported with -M spsc or bytes\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    // the io_uring producer only streams; the consumer takes either framing
+    if (uring_arg && (!u_arg || epoll_arg || fd_mode || (is_producer && !stream_mode))) {
+        fprintf(stderr, "Error: -U needs -u, a producer also needs -k, and it excludes -E and -F\n");
+        exit(EXIT_FAILURE);
+    }
+    // without -k every message is a connection of its own, so only -P says when the last has come
+    if ((epoll_arg || uring_arg) && is_consumer && !stream_mode && expected_producers == 0) {
+        fprintf(stderr, "Error: -E or -U without -k needs -P <messages>, one connection per message\n");
+        exit(EXIT_FAILURE);
+    }
+    // descriptor passing has its own framing and is served by the select consumer only
+    if (fd_mode && (stream_mode || epoll_arg || !u_arg)) {
+        fprintf(stderr, "Error: -F is only supported with -u and without -k or -E\n");
+        exit(EXIT_FAILURE);
+    }
+    if (clock_arg && !bench_mode) {
+        fprintf(stderr, "Error: -Y needs -j\n");
+        exit(EXIT_FAILURE);
+    }
+    // TSC stamps are converted to ns by the consumer, which can also be asked for a report
+    if (bench_mode && is_consumer) {
+        if (stamp_clock == CLOCK_TSC) {
+            calibrate_tsc();
+        }
+        signal(SIGUSR1, request_report);
+    }
+    // the send timestamp overwrites the start of each message
+    if (bench_mode && is_producer && strlen(msg) < STAMP_LEN) {
+        fprintf(stderr, "Error: -j needs messages of at least %d bytes\n", STAMP_LEN);
+        exit(EXIT_FAILURE);
+    }
+
     //create semaphores
-    full = sem_open(SEM_FULL, O_CREAT, 0666, 0);
-    empty = sem_open(SEM_EMPTY, O_CREAT, 0666, q_depth); 
-    mutex = sem_open(SEM_MUTEX, O_CREAT, 0666, 1);
+    full = sem_open(names.full, O_CREAT, 0666, 0);
+    empty = sem_open(names.empty, O_CREAT, 0666, q_depth); 
+    mutex = sem_open(names.mutex, O_CREAT, 0666, 1);
 
 
     if (empty == SEM_FAILED && errno == EEXIST) {
@@ -477,24 +4154,89 @@ int main(int argc, char *argv[]){
         exit(EXIT_FAILURE);
     }
 
+    // Without -B the byte ring gets the same storage the slot modes would
+    if (!bytes_arg) {
+        ring_bytes = (size_t)q_depth * BUFFER_SIZE;
+    }
+
     //producer for unix socket
     if(is_producer && u_arg) {
         if(!exist_msg){
             fprintf(stderr, "Error: -p requires -m \n");
             exit(EXIT_FAILURE);
         }
-        producer_socket(e_arg, msg, q_depth);
+        if(input_path != NULL){
+            producer_socket_records(e_arg);
+        }
+        else if(uring_arg){
+            producer_socket_uring(e_arg, msg, msg_count);
+        }
+        else if(stream_mode){
+            producer_socket_stream(e_arg, msg, msg_count);
+        }
+        else if(fd_mode){
+            producer_socket_fd(e_arg, msg, msg_count);
+        }
+        else{
+            producer_socket(e_arg, msg, msg_count);
+        }
         cleanup();
 
     }
     //consumer for unix socket
     if(is_consumer && u_arg){
-        consumer_socket(e_arg,q_depth);
+        bench_transport = "unix";
+        bench_kind = stream_mode ? "stream" : fd_mode ? "memfd" : "message";
+        if(uring_arg){
+            bench_transport = "unix-uring";
+            consumer_socket_uring(e_arg);
+        }
+        else if(epoll_arg){
+            consumer_socket_epoll(e_arg);
+        }
+        else{
+            consumer_socket(e_arg,q_depth);
+        }
+        if(output_mode){
+            out_close();
+        }
+        if(bench_mode){
+            bench_report();
+        }
     }
     
+    //sharded shared memory queues
+    if(shard_arg){
+        if(is_producer && !exist_msg){
+            fprintf(stderr, "Error: -p requires -m\n ");
+            exit(EXIT_FAILURE);
+        }
+        attach_shards(q_depth, (size_t)q_depth * BUFFER_SIZE);
+        if(is_producer){
+            producer_sharded(msg, msg_count, e_arg);
+        }
+        else{
+            bench_transport = "shm";
+            bench_kind = "sharded";
+            consumer_sharded(e_arg);
+        }
+        print_wait_stats();
+        if(is_producer){
+            print_loss_stats();
+        }
+        if(bench_mode && is_consumer){
+            bench_report();
+        }
+        detach_shards(is_consumer);
+        sem_close(full);
+        sem_close(empty);
+        sem_close(mutex);
+        return 0;
+    }
+
     //shared memory creation for producer
     if(s_arg && is_producer){
-        create_sharedmem(q_depth);
+        create_sharedmem(q_depth, q_mode, ring_bytes);
     }
 
     //producer for shared memory
@@ -503,8 +4245,14 @@ int main(int argc, char *argv[]){
             fprintf(stderr, "Error: -p requires -m\n ");
             exit(EXIT_FAILURE);
         }
-        create_sharedmem(q_depth);
-        producer_shared(msg, q_depth, e_arg);
+        create_sharedmem(q_depth, q_mode, ring_bytes);
+        if (input_path != NULL) {
+            producer_records(e_arg);
+        } else {
+            producer_shared(msg, msg_count, e_arg);
+        }
+        print_wait_stats();
+        print_loss_stats();
         
         // Only close the semaphores but don't unlink them
         sem_close(full);
@@ -517,25 +4265,64 @@ int main(int argc, char *argv[]){
     
     //consumer for shared memory
     if(is_consumer && s_arg) {
-        int shm_fd = shm_open(SHM_NAME, O_RDWR, 0666);
-        if (shm_fd == -1) {
-            perror("Consumer: shm_open failed. Make sure a producer has created the shared memory");
+        // a consumer given -q creates the segment itself when no producer has yet, laid out
+        // from its own -q, -M, -O and -B, so it can be started first
+        int shm_fd = open_segment(&names, huge_pages, O_RDWR);
+        if (shm_fd == -1 && !(errno == ENOENT && queue_arg)) {
+            perror("Consumer: shm_open failed. Make sure a producer has created the shared memory or pass -q");
+            exit(EXIT_FAILURE);
+        }
+        struct stat shm_stat;
+        if (shm_fd != -1 && fstat(shm_fd, &shm_stat) == -1) {
+            perror("Consumer: fstat failed");
             exit(EXIT_FAILURE);
         }
         
         // Get the existing queue size from shared memory
-        queue_t *temp = mmap(NULL, sizeof(queue_t), PROT_READ, MAP_SHARED, shm_fd, 0);
-        if (temp == MAP_FAILED) {
-            perror("Consumer: mmap failed");
+        if (shm_fd != -1 && shm_stat.st_size >= (off_t)sizeof(queue_t)) {
+            queue_t *temp = mmap(NULL, sizeof(queue_t), PROT_READ, MAP_SHARED, shm_fd, 0);
+            if (temp == MAP_FAILED) {
+                perror("Consumer: mmap failed");
+                exit(EXIT_FAILURE);
+            }
+            if (segment_initialised(temp)) {
+                // Use the queue size, mode and policy from shared memory unless -M or -O was given
+                q_depth = temp->q_size;
+                if (!mode_arg) {
+                    q_mode = temp->mode;
+                }
+                if (!policy_arg) {
+                    overflow_policy = temp->policy;
+                }
+                if (!bytes_arg) {
+                    ring_bytes = temp->ring_bytes;
+                }
+            } else if (!queue_arg) {
+                fprintf(stderr, "Consumer: shared memory has not been initialised by a producer\n");
+                exit(EXIT_FAILURE);
+            }
+            munmap(temp, sizeof(queue_t));
+        } else if (!queue_arg) {
+            fprintf(stderr, "Consumer: shared memory has not been initialised by a producer\n");
             exit(EXIT_FAILURE);
         }
+        if (shm_fd != -1) {
+            close(shm_fd);
+        }
         
-        // Use the queue size from shared memory
-        q_depth = temp->q_size;
-        munmap(temp, sizeof(queue_t));
-        
-        create_sharedmem(q_depth);
+        create_sharedmem(q_depth, q_mode, ring_bytes);
+        consumer_attach();
+        bench_transport = "shm";
+        bench_kind = queue_mode_names[q_mode];
         consumer_shared(q_depth, e_arg);
+        if (output_mode) {
+            out_close();
+        }
+        print_wait_stats();
+        print_loss_stats();
+        if (bench_mode) {
+            bench_report();
+        }
         cleanup(); // Only consumer does full cleanup
     }
     
@@ -0,0 +1,97 @@
+#!/bin/bash
+# Round-trip checks for the -M bytes ring with variable-size records: every input file is
+# streamed through -p -s -i into a -c -s -o consumer and must come out byte for byte. The
+# small ring puts records of more than half its size at every offset, so some need a pad
+# marker published on its own before they fit.
+#
+# Usage: ./test_ipcshared.sh
+# The checks always run against ipcshared.c as it is now, compiled into the scratch directory,
+# never the binary sitting next to it. Override through the environment, e.g.
+# RING=8192 WAITS="park" ./test_ipcshared.sh, or BIN=/path/to/ipcshared to test a given build.
+
+RING=${RING:-4096}
+WAITS=${WAITS:-"spin park block"}
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+failures=0
+
+if [ -z "$BIN" ]; then
+    BIN=$dir/ipcshared
+    if ! ${CC:-gcc} -O2 -o "$BIN" "$(dirname "$0")/ipcshared.c" -lpthread; then
+        echo "Error: ipcshared.c does not build, nothing was tested" >&2
+        exit 1
+    fi
+elif [ ! -x "$BIN" ]; then
+    echo "Error: BIN=$BIN is not an executable" >&2
+    exit 1
+fi
+
+# wait until the consumer has attached to the segment; with -o it reports on stderr
+wait_ready() {
+    local log=$1 pid=$2
+    until grep -qs '^Consumer started' "$log"; do
+        if ! kill -0 "$pid" 2>/dev/null; then
+            return 1
+        fi
+        sleep 0.01
+    done
+}
+
+# run_case <name> <input file> <wait policy> [extra ipcshared flags]
+run_case() {
+    local name=$1 in=$2 wait=$3
+    shift 3
+    local topic="test$$" out="$dir/out" log="$dir/log"
+    rm -f "$out" "$log"
+    "$BIN" -c -s -t "$topic" -q 1 -M bytes -B "$RING" -w "$wait" -P 1 -o "$@" > "$out" 2> "$log" &
+    local consumer=$!
+    if ! wait_ready "$log" "$consumer"; then
+        echo "FAIL $name: consumer exited before it was ready"
+        cat "$log" >&2
+        failures=$((failures + 1))
+        return
+    fi
+    timeout 30 "$BIN" -p -s -t "$topic" -q 1 -M bytes -B "$RING" -w "$wait" -i "$in" "$@" > /dev/null 2>&1
+    local status=$?
+    if [ $status -ne 0 ]; then
+        kill "$consumer" 2>/dev/null
+    fi
+    wait "$consumer"
+    if [ $status -ne 0 ]; then
+        echo "FAIL $name: producer exited with $status"
+        failures=$((failures + 1))
+    elif ! cmp -s "$in" "$out"; then
+        echo "FAIL $name: output differs from input"
+        failures=$((failures + 1))
+    else
+        echo "PASS $name"
+    fi
+}
+
+# a record just under half the ring leaves head where the next, over half the ring, needs
+# more than the whole ring together with its pad
+awk -v a=1700 -v b=2500 'BEGIN {
+    s = sprintf("%*s", a, ""); gsub(/ /, "a", s); print s
+    s = sprintf("%*s", b, ""); gsub(/ /, "b", s); print s
+}' > "$dir/pad_alone"
+
+# a fixed pseudo-random mix from one byte up to nearly the whole ring
+awk -v ring="$RING" 'BEGIN {
+    srand(1)
+    split("1 7 100 0.3 0.45 0.5 0.55 0.7 0.9 0.97", sizes, " ")
+    for (i = 0; i < 3000; i++) {
+        f = sizes[int(rand() * 10) + 1]
+        len = (f < 1) ? int(f * ring) : f
+        s = sprintf("%*s", len, ""); gsub(/ /, sprintf("%c", 97 + i % 26), s); print s
+    }
+}' > "$dir/mixed"
+
+for wait in $WAITS; do
+    run_case "pad_alone -w $wait" "$dir/pad_alone" "$wait"
+    run_case "mixed -w $wait" "$dir/mixed" "$wait"
+done
+# consumers only read up to the group commit, so a lone pad must be committed as well
+run_case "mixed -J" "$dir/mixed" park -J "$dir/journal"
+
+exit $((failures > 0))